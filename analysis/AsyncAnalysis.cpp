@@ -0,0 +1,250 @@
+#include "AsyncAnalysis.h"
+#include "LoopAnalysis.h"
+
+#include "clang/AST/DeclCXX.h"
+#include "clang/AST/ExprCXX.h"
+#include "clang/AST/ParentMapContext.h"
+#include "llvm/ADT/STLExtras.h"
+
+using namespace llvm;
+
+namespace clang::parallel {
+
+const VarDecl *getRootVariable(const Expr *E) {
+  while (true) {
+    E = E->IgnoreParenCasts();
+    if (const auto *Ref = dyn_cast<DeclRefExpr>(E))
+      return dyn_cast<VarDecl>(Ref->getDecl());
+    if (const auto *Member = dyn_cast<MemberExpr>(E))
+      E = Member->getBase();
+    else if (const auto *Subscript = dyn_cast<ArraySubscriptExpr>(E))
+      E = Subscript->getBase();
+    else if (const auto *Op = dyn_cast<UnaryOperator>(E);
+             Op && Op->getOpcode() == UO_Deref)
+      E = Op->getSubExpr();
+    else if (const auto *Call = dyn_cast<CXXOperatorCallExpr>(E);
+             Call && Call->getNumArgs() != 0 &&
+             (Call->getOperator() == OO_Subscript ||
+              Call->getOperator() == OO_Star ||
+              Call->getOperator() == OO_Arrow))
+      E = Call->getArg(0);
+    else
+      return nullptr;
+  }
+}
+
+// The lvalue S writes to, if S is an assignment, an increment or a call to a
+// non-const member function.
+static const Expr *getWrittenLValue(const Stmt &S) {
+  if (const auto *Op = dyn_cast<BinaryOperator>(&S))
+    return Op->isAssignmentOp() ? Op->getLHS() : nullptr;
+  if (const auto *Op = dyn_cast<UnaryOperator>(&S))
+    return Op->isIncrementDecrementOp() ? Op->getSubExpr() : nullptr;
+  if (const auto *Call = dyn_cast<CXXOperatorCallExpr>(&S)) {
+    OverloadedOperatorKind Kind = Call->getOperator();
+    if (Call->getNumArgs() != 0 &&
+        (Call->isAssignmentOp() || Kind == OO_PlusPlus ||
+         Kind == OO_MinusMinus))
+      return Call->getArg(0);
+    return nullptr;
+  }
+  if (const auto *Call = dyn_cast<CXXMemberCallExpr>(&S)) {
+    const auto *Method = Call->getMethodDecl();
+    if (Method && !Method->isStatic() && !Method->isConst())
+      return Call->getImplicitObjectArgument();
+  }
+  return nullptr;
+}
+
+LoopFootprint::LoopFootprint(const Stmt &Loop) {
+  const VarDecl *LoopVar = getLoopVariable(Loop);
+  Locals.insert(LoopVar);
+  if (const auto *For = dyn_cast<CXXForRangeStmt>(&Loop)) {
+    const Expr *Range = For->getRangeInit();
+    observeHeader(Range);
+    // Elements bound to a mutable reference may be written.
+    QualType Type = LoopVar->getType();
+    if (Range && Type->isReferenceType() &&
+        !Type.getNonReferenceType().isConstQualified())
+      if (const VarDecl *Var = getRootVariable(Range))
+        Written.insert(Var);
+  } else if (const auto *For = dyn_cast<ForStmt>(&Loop)) {
+    observeHeader(For->getInit());
+    observeHeader(For->getCond());
+    observeHeader(For->getInc());
+  }
+}
+
+void LoopFootprint::observeHeader(const Stmt *S) {
+  if (!S)
+    return;
+  if (const auto *Ref = dyn_cast<DeclRefExpr>(S))
+    use(dyn_cast<VarDecl>(Ref->getDecl()));
+  for (const Stmt *Child : S->children())
+    observeHeader(Child);
+}
+
+void LoopFootprint::use(const VarDecl *Var) {
+  if (Var && !Locals.contains(Var) && Used.insert(Var).second)
+    UsedInOrder.push_back(Var);
+}
+
+void LoopFootprint::observe(const Decl &D) {
+  if (const auto *Var = dyn_cast<VarDecl>(&D))
+    Locals.insert(Var);
+}
+
+void LoopFootprint::observe(const Stmt &S) {
+  if (const auto *Ref = dyn_cast<DeclRefExpr>(&S)) {
+    use(dyn_cast<VarDecl>(Ref->getDecl()));
+    return;
+  }
+  if (const Expr *LValue = getWrittenLValue(S))
+    if (const VarDecl *Var = getRootVariable(LValue))
+      if (!Locals.contains(Var))
+        Written.insert(Var);
+}
+
+static Error asyncError(const Twine &Message) {
+  return make_error<StringError>(Message, inconvertibleErrorCode());
+}
+
+// The parent of S, when it is a statement.
+static const Stmt *getParentStmt(const Stmt &S, ASTContext &Ctx) {
+  auto Parents = Ctx.getParents(S);
+  return Parents.size() == 1 ? Parents[0].get<Stmt>() : nullptr;
+}
+
+static bool declares(const Stmt &S, const VarDecl &Var) {
+  const auto *Decls = dyn_cast<DeclStmt>(&S);
+  return Decls && is_contained(Decls->decls(), &Var);
+}
+
+static bool references(const Stmt *S, const VarDecl &Var) {
+  if (!S)
+    return false;
+  if (const auto *Ref = dyn_cast<DeclRefExpr>(S))
+    if (Ref->getDecl() == &Var)
+      return true;
+  return any_of(S->children(),
+                [&](const Stmt *Child) { return references(Child, Var); });
+}
+
+Expected<const VarDecl *> findAsyncHandle(const AttributedStmt &Attr,
+                                          StringRef Name, ASTContext &Ctx) {
+  const Stmt *Child = &Attr;
+  while (const Stmt *Parent = getParentStmt(*Child, Ctx)) {
+    if (const auto *Block = dyn_cast<CompoundStmt>(Parent)) {
+      const VarDecl *Found = nullptr;
+      for (const Stmt *S : Block->body()) {
+        if (S == Child)
+          break;
+        if (const auto *Decls = dyn_cast<DeclStmt>(S))
+          for (const Decl *D : Decls->decls())
+            if (const auto *Var = dyn_cast<VarDecl>(D))
+              if (Var->getIdentifier() && Var->getName() == Name)
+                Found = Var;
+      }
+      if (Found) {
+        const auto *Record = Found->getType()->getAsCXXRecordDecl();
+        if (!Record || !Record->isInStdNamespace() ||
+            Record->getName() != "future")
+          return asyncError("handle '" + Name +
+                            "' must be a std::future<void>, not '" +
+                            Found->getType().getAsString() + "'");
+        return Found;
+      }
+    }
+    Child = Parent;
+  }
+  return asyncError("handle '" + Name +
+                    "' must be a std::future<void> declared before the loop "
+                    "in a block enclosing it");
+}
+
+namespace {
+// Checks the statements running alongside an asynchronous loop.
+class ConflictFinder {
+public:
+  explicit ConflictFinder(const LoopFootprint &Loop) : Loop(Loop) {}
+
+  SmallVector<AsyncConflict, 4> Conflicts;
+
+  void check(const Stmt *S) {
+    if (!S)
+      return;
+    if (const auto *Ref = dyn_cast<DeclRefExpr>(S)) {
+      const auto *Var = dyn_cast<VarDecl>(Ref->getDecl());
+      if (Var && Loop.writes(Var) && Reported.insert(Var).second)
+        Conflicts.push_back({AsyncConflict::UsesWritten, Var, Ref});
+    }
+    if (const Expr *LValue = getWrittenLValue(*S)) {
+      const VarDecl *Var = getRootVariable(LValue);
+      if (Var && Loop.uses(Var) && !Loop.writes(Var) &&
+          Reported.insert(Var).second)
+        Conflicts.push_back({AsyncConflict::WritesRead, Var, cast<Expr>(S)});
+    }
+    for (const Stmt *Child : S->children())
+      check(Child);
+  }
+
+  void outlivedBy(const VarDecl *Var) {
+    if (Loop.uses(Var))
+      Conflicts.push_back({AsyncConflict::OutlivedBy, Var});
+  }
+
+private:
+  const LoopFootprint &Loop;
+  SmallPtrSet<const VarDecl *, 8> Reported;
+};
+} // namespace
+
+SmallVector<AsyncConflict, 4>
+findAsyncConflicts(const AttributedStmt &Attr, const LoopFootprint &Loop,
+                   const VarDecl &Handle, ASTContext &Ctx) {
+  ConflictFinder Finder(Loop);
+  const Stmt *Child = &Attr;
+  while (const Stmt *Parent = getParentStmt(*Child, Ctx)) {
+    const auto *Block = dyn_cast<CompoundStmt>(Parent);
+    if (!Block) {
+      Child = Parent;
+      continue;
+    }
+    bool After = false, Joined = false, DeclaresHandle = false;
+    for (const Stmt *S : Block->body()) {
+      DeclaresHandle |= declares(*S, Handle);
+      if (S == Child) {
+        After = true;
+        continue;
+      }
+      if (!After)
+        continue;
+      if (references(S, Handle)) {
+        Joined = true;
+        break;
+      }
+      Finder.check(S);
+    }
+    if (Joined)
+      break;
+    // The locals of the block are destroyed before the loop is waited for,
+    // which is at the end of the block declaring the handle, whose locals
+    // declared after the handle are destroyed first.
+    bool AfterHandle = !DeclaresHandle;
+    for (const Stmt *S : Block->body()) {
+      AfterHandle |= declares(*S, Handle);
+      if (!AfterHandle)
+        continue;
+      if (const auto *Decls = dyn_cast<DeclStmt>(S))
+        for (const Decl *D : Decls->decls())
+          if (const auto *Var = dyn_cast<VarDecl>(D))
+            Finder.outlivedBy(Var);
+    }
+    if (DeclaresHandle)
+      break;
+    Child = Parent;
+  }
+  return std::move(Finder.Conflicts);
+}
+
+} // namespace clang::parallel
@@ -0,0 +1,80 @@
+#ifndef PARALLEL_ASYNC_ANALYSIS_H
+#define PARALLEL_ASYNC_ANALYSIS_H
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Decl.h"
+#include "clang/AST/Expr.h"
+#include "clang/AST/StmtCXX.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/Error.h"
+
+namespace clang::parallel {
+
+// The variable whose memory an lvalue designates, looking through members,
+// elements and dereferences, e.g. `a` for `a[i].x`.
+const VarDecl *getRootVariable(const Expr *E);
+
+// The variables of the enclosing scope a parallel loop uses, and those among
+// them it writes: assigns, increments, calls a non-const member function on,
+// or writes an element of. Writes hidden behind calls are not seen.
+//
+// The body has to be observed in pre-order like DataRaceTracker does; the
+// header of the loop is observed on construction.
+class LoopFootprint {
+public:
+  explicit LoopFootprint(const Stmt &Loop);
+
+  void observe(const Decl &D);
+  void observe(const Stmt &S);
+
+  bool uses(const VarDecl *Var) const { return Used.contains(Var); }
+  bool writes(const VarDecl *Var) const { return Written.contains(Var); }
+  llvm::ArrayRef<const VarDecl *> getUsed() const { return UsedInOrder; }
+
+private:
+  llvm::SmallPtrSet<const VarDecl *, 8> Locals;
+  llvm::SmallPtrSet<const VarDecl *, 16> Used;
+  llvm::SmallVector<const VarDecl *, 16> UsedInOrder;
+  llvm::SmallPtrSet<const VarDecl *, 8> Written;
+
+  void use(const VarDecl *Var);
+  void observeHeader(const Stmt *S);
+};
+
+// Finds the handle `async(<Name>)` launches the loop of Attr into: a
+// std::future declared before the loop in a block enclosing it.
+llvm::Expected<const VarDecl *>
+findAsyncHandle(const AttributedStmt &Attr, llvm::StringRef Name,
+                ASTContext &Ctx);
+
+// Something the code running alongside an asynchronous parallel loop does
+// that races with the loop.
+struct AsyncConflict {
+  enum KindT {
+    // Uses a variable the loop writes.
+    UsesWritten,
+    // Writes a variable the loop reads.
+    WritesRead,
+    // A variable the loop uses goes out of scope before the handle, so the
+    // loop may still use it after it was destroyed.
+    OutlivedBy,
+  };
+  KindT Kind;
+  const VarDecl *Var;
+  // The use or write, null for OutlivedBy.
+  const Expr *Access = nullptr;
+};
+
+// Finds the conflicts of the loop of Attr, whose footprint is Loop, with the
+// statements following it up to the first one using Handle, which waits for
+// the loop. Without such a statement, the loop is waited for when Handle goes
+// out of scope, so the statements following the enclosing blocks are checked
+// as well, up to the block declaring Handle.
+llvm::SmallVector<AsyncConflict, 4>
+findAsyncConflicts(const AttributedStmt &Attr, const LoopFootprint &Loop,
+                   const VarDecl &Handle, ASTContext &Ctx);
+
+} // namespace clang::parallel
+
+#endif
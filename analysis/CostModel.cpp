@@ -0,0 +1,163 @@
+#include "CostModel.h"
+#include "LoopAnalysis.h"
+
+#include "clang/AST/DeclCXX.h"
+#include "clang/AST/DeclTemplate.h"
+#include "clang/AST/ExprCXX.h"
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "clang/AST/Type.h"
+#include "llvm/ADT/StringSwitch.h"
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+using namespace llvm;
+
+namespace clang::parallel {
+
+// Number of elements of std::array<T, N>.
+static std::optional<std::uint64_t> getStdArraySize(QualType Type) {
+  const auto *Spec = dyn_cast_or_null<ClassTemplateSpecializationDecl>(
+      Type.getNonReferenceType()->getAsCXXRecordDecl());
+  if (!Spec || !Spec->isInStdNamespace() || Spec->getName() != "array")
+    return std::nullopt;
+  const auto &Args = Spec->getTemplateArgs();
+  if (Args.size() != 2 || Args[1].getKind() != TemplateArgument::Integral)
+    return std::nullopt;
+  return Args[1].getAsIntegral().getZExtValue();
+}
+
+// Size of a standard sequence container given to its constructor, as in
+// `std::vector<int> v(100)` or `std::vector<int> v{1, 2, 3}`.
+static std::optional<std::uint64_t> getConstructedSize(const VarDecl &Var,
+                                                       ASTContext &Ctx) {
+  const auto *Record = Var.getType()->getAsCXXRecordDecl();
+  if (!Record || !Record->isInStdNamespace() ||
+      !StringSwitch<bool>(Record->getName())
+           .Cases("vector", "deque", "basic_string", true)
+           .Default(false))
+    return std::nullopt;
+  const Expr *Init = Var.getInit();
+  if (!Init)
+    return std::nullopt;
+  Init = Init->IgnoreImplicit();
+  if (const auto *Construct = dyn_cast<CXXConstructExpr>(Init)) {
+    if (Construct->getNumArgs() == 0)
+      return std::nullopt;
+    const Expr *First = Construct->getArg(0)->IgnoreImplicit();
+    if (const auto *List = dyn_cast<CXXStdInitializerListExpr>(First))
+      if (const auto *Elements = dyn_cast<InitListExpr>(
+              List->getSubExpr()->IgnoreImplicit()->IgnoreParens()))
+        return Elements->getNumInits();
+    // The count constructors take an integral first argument, the others
+    // iterators, allocators or containers.
+    if (!First->getType()->isIntegralOrEnumerationType())
+      return std::nullopt;
+    if (auto Value = First->getIntegerConstantExpr(Ctx))
+      return Value->getZExtValue();
+  }
+  return std::nullopt;
+}
+
+// Iterations of a counted loop whose bounds are constants.
+static std::optional<std::uint64_t> getCountedTripCount(const ForStmt &For,
+                                                        ASTContext &Ctx) {
+  auto Loop = getCountedLoop(For, Ctx);
+  if (!Loop) {
+    consumeError(Loop.takeError());
+    return std::nullopt;
+  }
+  auto Begin = Loop->Begin->getIntegerConstantExpr(Ctx);
+  auto End = Loop->End->getIntegerConstantExpr(Ctx);
+  if (!Begin || !End)
+    return std::nullopt;
+  std::int64_t From = Begin->getExtValue(), To = End->getExtValue();
+  std::int64_t Step = Loop->Step;
+  if (Step < 0) {
+    std::swap(From, To);
+    Step = -Step;
+  }
+  if (Loop->Inclusive)
+    return From > To ? 0 : (To - From) / Step + 1;
+  return From >= To ? 0 : (To - From + Step - 1) / Step;
+}
+
+std::optional<TripCount> getTripCount(const Stmt &Loop, ASTContext &Ctx) {
+  if (const auto *Counted = dyn_cast<ForStmt>(&Loop)) {
+    if (auto Count = getCountedTripCount(*Counted, Ctx))
+      return TripCount{*Count, true};
+    return std::nullopt;
+  }
+  const auto &For = cast<CXXForRangeStmt>(Loop);
+  const Expr *Range = For.getRangeInit();
+  if (!Range)
+    return std::nullopt;
+  QualType Type = Range->getType().getNonReferenceType();
+  if (const auto *Array = Ctx.getAsConstantArrayType(Type))
+    return TripCount{Array->getSize().getZExtValue(), true};
+  if (auto Size = getStdArraySize(Type))
+    return TripCount{*Size, true};
+  if (const auto *Ref = dyn_cast<DeclRefExpr>(Range->IgnoreParenImpCasts()))
+    if (const auto *Var = dyn_cast<VarDecl>(Ref->getDecl()))
+      if (Var->hasLocalStorage())
+        if (auto Size = getConstructedSize(*Var, Ctx))
+          return TripCount{*Size, false, Var};
+  return std::nullopt;
+}
+
+static std::uint64_t getWeight(const Stmt &S) {
+  if (isa<ForStmt, WhileStmt, DoStmt, CXXForRangeStmt>(S))
+    return 256;
+  if (isa<CXXNewExpr, CXXDeleteExpr, CXXThrowExpr>(S))
+    return 64;
+  if (isa<CXXOperatorCallExpr>(S))
+    return 1;
+  if (isa<CallExpr>(S))
+    return 16;
+  if (const auto *Binary = dyn_cast<BinaryOperator>(&S)) {
+    switch (Binary->getOpcode()) {
+    case BO_Div:
+    case BO_Rem:
+    case BO_DivAssign:
+    case BO_RemAssign:
+      return 8;
+    case BO_Comma:
+      return 0;
+    default:
+      return 1;
+    }
+  }
+  if (isa<UnaryOperator, ArraySubscriptExpr, ConditionalOperator>(S))
+    return 1;
+  return 0;
+}
+
+void CostEstimator::observe(const Stmt &S) {
+  std::uint64_t Weight = getWeight(S);
+  Cost = Cost > std::numeric_limits<std::uint64_t>::max() - Weight
+             ? std::numeric_limits<std::uint64_t>::max()
+             : Cost + Weight;
+}
+
+namespace {
+class CostVisitor : public RecursiveASTVisitor<CostVisitor> {
+public:
+  explicit CostVisitor(CostEstimator &Estimator) : Estimator(Estimator) {}
+
+  bool VisitStmt(Stmt *S) {
+    Estimator.observe(*S);
+    return true;
+  }
+
+private:
+  CostEstimator &Estimator;
+};
+} // namespace
+
+std::uint64_t estimateIterationCost(const Stmt &Body) {
+  CostEstimator Estimator;
+  CostVisitor(Estimator).TraverseStmt(const_cast<Stmt *>(&Body));
+  return Estimator.getCost();
+}
+
+} // namespace clang::parallel
@@ -0,0 +1,52 @@
+#ifndef PARALLEL_COST_MODEL_H
+#define PARALLEL_COST_MODEL_H
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/StmtCXX.h"
+#include <cstdint>
+#include <optional>
+
+namespace clang::parallel {
+
+// Estimated operations below which a parallel loop costs more to dispatch
+// than it saves, in the units of CostEstimator: a few microseconds of work.
+inline constexpr std::uint64_t DefaultMinParallelWork = 1 << 15;
+
+// Number of iterations of a parallel loop known at compile time.
+struct TripCount {
+  std::uint64_t Count;
+  // The count follows from the type of the range, e.g. `int[64]` or
+  // `std::array<int, 64>`, or from the constant bounds of a counted loop.
+  // Otherwise it is the size a local container was constructed with, which
+  // may have changed before the loop.
+  bool Exact;
+  // The container the count was taken from, when it is not exact.
+  const VarDecl *Container = nullptr;
+};
+
+// Loop is a for-range or counted `for` loop.
+std::optional<TripCount> getTripCount(const Stmt &Loop, ASTContext &Ctx);
+
+// Rough number of operations one iteration of a loop body performs. Every
+// statement of the body has to be observed once, in any order. Calls and
+// nested loops get a large weight, since what they do is unknown.
+class CostEstimator {
+public:
+  void observe(const Stmt &S);
+  std::uint64_t getCost() const { return Cost ? Cost : 1; }
+
+private:
+  std::uint64_t Cost = 0;
+};
+
+// Runs a CostEstimator over every statement of Body.
+std::uint64_t estimateIterationCost(const Stmt &Body);
+
+// Whether Count iterations of Cost operations each fall below MinWork.
+inline bool isTooCheap(std::uint64_t Count, std::uint64_t Cost,
+                       std::uint64_t MinWork) {
+  return Count < MinWork / Cost + (MinWork % Cost != 0);
+}
+
+} // namespace clang::parallel
+
+#endif
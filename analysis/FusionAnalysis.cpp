@@ -0,0 +1,166 @@
+#include "FusionAnalysis.h"
+#include "AsyncAnalysis.h"
+#include "LoopAnalysis.h"
+#include "ParallelOptions.h"
+#include "VectorizeAnalysis.h"
+
+#include "clang/AST/ParentMapContext.h"
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "clang/AST/StmtCXX.h"
+#include "llvm/ADT/FoldingSet.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include <optional>
+
+using namespace llvm;
+
+namespace clang::parallel {
+
+namespace {
+// A loop that may be fused with its neighbors, and what its body uses.
+struct FusionCandidate {
+  const AttributedStmt *Attr;
+  const CXXForRangeStmt *For;
+  // The variable holding the range.
+  const VarDecl *Range;
+  LoopFootprint Footprint;
+  // Variables the body refers to, unlike the footprint, which includes the
+  // header.
+  SmallPtrSet<const VarDecl *, 8> Referenced;
+};
+
+class FootprintWalker : public RecursiveASTVisitor<FootprintWalker> {
+public:
+  explicit FootprintWalker(FusionCandidate &Loop) : Loop(Loop) {}
+
+  bool VisitDecl(Decl *D) {
+    Loop.Footprint.observe(*D);
+    return true;
+  }
+
+  bool VisitStmt(Stmt *S) {
+    Loop.Footprint.observe(*S);
+    if (const auto *Ref = dyn_cast<DeclRefExpr>(S))
+      if (const auto *Var = dyn_cast<VarDecl>(Ref->getDecl()))
+        Loop.Referenced.insert(Var);
+    return true;
+  }
+
+private:
+  FusionCandidate &Loop;
+};
+} // namespace
+
+static bool hasFusionBlocker(const Stmt &Loop, const ParallelOptions &Opts) {
+  return any_of(findVectorizeBlockers(Loop, Opts),
+                [](const VectorizeBlocker &Blocker) {
+                  return Blocker.Kind != VectorizeBlocker::Allocation;
+                });
+}
+
+// Whether Var is a value no other variable points into.
+static bool isScalarValue(const VarDecl &Var) {
+  QualType Type = Var.getType();
+  return Type->isArithmeticType() || Type->isEnumeralType();
+}
+
+static std::optional<FusionCandidate> getCandidate(const Stmt &S,
+                                                   ASTContext &Ctx) {
+  const auto *Attr = dyn_cast<AttributedStmt>(&S);
+  if (!Attr || !getParallelAnnotation(*Attr) ||
+      Attr->getBeginLoc().isMacroID() || Attr->getEndLoc().isMacroID())
+    return std::nullopt;
+  const auto *For = dyn_cast<CXXForRangeStmt>(Attr->getSubStmt());
+  if (!For || !isa<CompoundStmt>(For->getBody()) || !For->getRangeInit() ||
+      For->getRangeInit()->HasSideEffects(Ctx))
+    return std::nullopt;
+  auto Opts = getParallelOptions(*Attr);
+  if (!Opts) {
+    consumeError(Opts.takeError());
+    return std::nullopt;
+  }
+  if (!Opts->Async.empty() || !Opts->Privates.empty())
+    return std::nullopt;
+  auto Nested = getCollapsedLoop(*For, *Opts, Ctx);
+  if (!Nested) {
+    consumeError(Nested.takeError());
+    return std::nullopt;
+  }
+  if (*Nested || hasFusionBlocker(*For, *Opts))
+    return std::nullopt;
+
+  const VarDecl *Range = getRootVariable(For->getRangeInit());
+  if (!Range)
+    return std::nullopt;
+  FusionCandidate Loop{Attr, For, Range, LoopFootprint(*For), {}};
+  FootprintWalker(Loop).TraverseStmt(const_cast<Stmt *>(For->getBody()));
+  if (Loop.Referenced.contains(Range))
+    return std::nullopt;
+  for (const VarDecl *Var : Loop.Footprint.getUsed())
+    if (Var != Range && Loop.Footprint.writes(Var))
+      return std::nullopt;
+  return Loop;
+}
+
+static bool canFuse(const FusionCandidate &A, const FusionCandidate &B,
+                    ASTContext &Ctx) {
+  auto ArgsA = getParallelArguments(*getParallelAnnotation(*A.Attr));
+  auto ArgsB = getParallelArguments(*getParallelAnnotation(*B.Attr));
+  if (!equal(ArgsA, ArgsB,
+             [](const StringLiteral *X, const StringLiteral *Y) {
+               return X->getString() == Y->getString();
+             }))
+    return false;
+
+  FoldingSetNodeID RangeA, RangeB;
+  A.For->getRangeInit()->Profile(RangeA, Ctx, /*Canonical=*/true);
+  B.For->getRangeInit()->Profile(RangeB, Ctx, /*Canonical=*/true);
+  if (RangeA != RangeB)
+    return false;
+
+  // Elements written by one loop may be read by the other through anything
+  // but a plain value.
+  if (!A.Footprint.writes(A.Range) && !B.Footprint.writes(B.Range))
+    return true;
+  for (const FusionCandidate *Loop : {&A, &B})
+    for (const VarDecl *Var : Loop->Footprint.getUsed())
+      if (Var != Loop->Range && !isScalarValue(*Var))
+        return false;
+  return true;
+}
+
+SmallVector<const AttributedStmt *, 2>
+getFusedLoops(const AttributedStmt &Attr, ASTContext &Ctx) {
+  SmallVector<const AttributedStmt *, 2> Fused = {&Attr};
+  auto Parents = Ctx.getParents(Attr);
+  const auto *Block =
+      Parents.size() == 1 ? Parents[0].get<CompoundStmt>() : nullptr;
+  if (!Block)
+    return Fused;
+
+  auto Contains = [&](ArrayRef<FusionCandidate> Run) {
+    return any_of(Run,
+                  [&](const FusionCandidate &C) { return C.Attr == &Attr; });
+  };
+  SmallVector<FusionCandidate, 2> Run;
+  for (const Stmt *S : Block->body()) {
+    std::optional<FusionCandidate> Next = getCandidate(*S, Ctx);
+    if (!Next || !all_of(Run, [&](const FusionCandidate &Loop) {
+          return canFuse(Loop, *Next, Ctx);
+        })) {
+      if (Contains(Run))
+        break;
+      Run.clear();
+    }
+    if (Next)
+      Run.push_back(std::move(*Next));
+  }
+  if (Run.size() < 2 || !Contains(Run))
+    return Fused;
+  Fused.clear();
+  for (const FusionCandidate &Loop : Run)
+    Fused.push_back(Loop.Attr);
+  return Fused;
+}
+
+} // namespace clang::parallel
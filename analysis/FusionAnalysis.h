@@ -0,0 +1,34 @@
+#ifndef PARALLEL_FUSION_ANALYSIS_H
+#define PARALLEL_FUSION_ANALYSIS_H
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Stmt.h"
+#include "llvm/ADT/SmallVector.h"
+
+namespace clang::parallel {
+
+// The run of adjacent `[[parallel]]` for-range loops Attr is fused with, in
+// source order and including Attr. Only Attr when it runs alone.
+//
+// Fused loops run the bodies of all loops on an element before moving on to
+// the next one, which is only the same as running the loops one after the
+// other when no body sees what another one does to a different element. So
+// the loops of a run:
+// * are consecutive statements of a block, outside of macros;
+// * have the same attribute arguments, are neither collapsed with a nested
+//   loop nor `async`, and have no `private` locals;
+// * iterate over the same range expression, a variable or its members,
+//   without side effects;
+// * write nothing but the elements of the range, through their loop
+//   variable, and neither use the range variable in their bodies, nor any
+//   other variable that may point into the range when one of them writes;
+// * could run unsequenced but for allocations, see findVectorizeBlockers, so
+//   that no call or synchronization hides a dependence.
+//
+// Runs are formed from the first statement of the block on, so every loop of
+// a run gets the same run.
+llvm::SmallVector<const AttributedStmt *, 2>
+getFusedLoops(const AttributedStmt &Attr, ASTContext &Ctx);
+
+} // namespace clang::parallel
+
+#endif
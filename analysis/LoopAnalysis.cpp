@@ -0,0 +1,440 @@
+#include "LoopAnalysis.h"
+
+#include "clang/AST/Decl.h"
+#include "clang/AST/DeclCXX.h"
+#include "clang/AST/DeclTemplate.h"
+#include "clang/AST/ExprCXX.h"
+#include "clang/AST/Type.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/ADT/Twine.h"
+#include <optional>
+
+using namespace llvm;
+
+namespace clang::parallel {
+
+// Whether Tag is the standard iterator tag Name or is derived from it.
+static bool isIteratorTag(const CXXRecordDecl *Tag, StringRef Name) {
+  if (!Tag)
+    return false;
+  if (Tag->isInStdNamespace() && Tag->getName() == Name)
+    return true;
+  if (!Tag->hasDefinition())
+    return false;
+  for (const auto &Base : Tag->bases())
+    if (isIteratorTag(Base.getType()->getAsCXXRecordDecl(), Name))
+      return true;
+  return false;
+}
+
+// Looks up the `iterator_category` member typedef of an iterator class,
+// including the ones inherited from its bases.
+static const CXXRecordDecl *getIteratorCategory(const CXXRecordDecl *Iterator,
+                                                ASTContext &Ctx) {
+  if (!Iterator || !Iterator->hasDefinition())
+    return nullptr;
+  for (const auto *Found :
+       Iterator->lookup(&Ctx.Idents.get("iterator_category")))
+    if (const auto *Typedef = dyn_cast<TypedefNameDecl>(Found))
+      return Typedef->getUnderlyingType()->getAsCXXRecordDecl();
+  for (const auto &Base : Iterator->bases())
+    if (const auto *Category =
+            getIteratorCategory(Base.getType()->getAsCXXRecordDecl(), Ctx))
+      return Category;
+  return nullptr;
+}
+
+// Standard containers whose iterators are random-access class types even
+// though their elements are adjacent in memory.
+static bool isContiguousContainer(QualType RangeType) {
+  const auto *Record = RangeType.getNonReferenceType()->getAsCXXRecordDecl();
+  if (!Record || !Record->isInStdNamespace())
+    return false;
+  bool Known = StringSwitch<bool>(Record->getName())
+                   .Cases("vector", "array", "basic_string", true)
+                   .Cases("basic_string_view", "span", true)
+                   .Default(false);
+  if (!Known)
+    return false;
+  // std::vector<bool> packs its elements into bits.
+  if (Record->getName() == "vector")
+    if (const auto *Spec = dyn_cast<ClassTemplateSpecializationDecl>(Record))
+      return !Spec->getTemplateArgs()[0].getAsType()->isBooleanType();
+  return true;
+}
+
+static bool isHashContainer(QualType RangeType) {
+  const auto *Record = RangeType.getNonReferenceType()->getAsCXXRecordDecl();
+  return Record && Record->isInStdNamespace() &&
+         StringSwitch<bool>(Record->getName())
+             .Cases("unordered_map", "unordered_multimap", true)
+             .Cases("unordered_set", "unordered_multiset", true)
+             .Default(false);
+}
+
+bool hasContiguousData(const CXXForRangeStmt &For) {
+  const Expr *Init = For.getRangeInit();
+  return Init && isContiguousContainer(Init->getType());
+}
+
+RangeKind classifyRange(const CXXForRangeStmt &For, ASTContext &Ctx) {
+  const VarDecl *Begin = For.getBeginStmt()
+                             ? cast<VarDecl>(For.getBeginStmt()->getSingleDecl())
+                             : nullptr;
+  if (!Begin)
+    return RangeKind::Sequential;
+  QualType Iterator = Begin->getType().getCanonicalType();
+  if (Iterator->isPointerType())
+    return RangeKind::Contiguous;
+
+  const auto *Category =
+      getIteratorCategory(Iterator->getAsCXXRecordDecl(), Ctx);
+  if (isIteratorTag(Category, "contiguous_iterator_tag"))
+    return RangeKind::Contiguous;
+  const Expr *Init = For.getRangeInit();
+  if (!isIteratorTag(Category, "random_access_iterator_tag")) {
+    // Input iterators may hand out the same object for every element.
+    if (!isIteratorTag(Category, "forward_iterator_tag"))
+      return RangeKind::Sequential;
+    if (Init && isHashContainer(Init->getType()))
+      return RangeKind::Hashed;
+    return RangeKind::Gathered;
+  }
+  if (Init && isContiguousContainer(Init->getType()))
+    return RangeKind::Contiguous;
+  return RangeKind::RandomAccess;
+}
+
+static Error loopError(const Twine &Message) {
+  return make_error<StringError>(Message, inconvertibleErrorCode());
+}
+
+static const VarDecl *getReferencedVar(const Expr *E) {
+  if (const auto *Ref = dyn_cast<DeclRefExpr>(E->IgnoreParenImpCasts()))
+    return dyn_cast<VarDecl>(Ref->getDecl());
+  return nullptr;
+}
+
+static void collectReferencedVars(const Stmt *S,
+                                  SmallPtrSetImpl<const VarDecl *> &Vars) {
+  if (!S)
+    return;
+  if (const auto *Ref = dyn_cast<DeclRefExpr>(S))
+    if (const auto *Var = dyn_cast<VarDecl>(Ref->getDecl()))
+      Vars.insert(Var);
+  for (const Stmt *Child : S->children())
+    collectReferencedVars(Child, Vars);
+}
+
+// Finds an assignment, increment, decrement or non-const member call in S
+// that modifies one of Vars, and returns the variable modified.
+static const VarDecl *findWrite(const Stmt *S,
+                                const SmallPtrSetImpl<const VarDecl *> &Vars) {
+  if (!S)
+    return nullptr;
+  const Expr *Target = nullptr;
+  if (const auto *Op = dyn_cast<BinaryOperator>(S)) {
+    if (Op->isAssignmentOp())
+      Target = Op->getLHS();
+  } else if (const auto *Op = dyn_cast<UnaryOperator>(S)) {
+    if (Op->isIncrementDecrementOp())
+      Target = Op->getSubExpr();
+  } else if (const auto *Call = dyn_cast<CXXOperatorCallExpr>(S)) {
+    if (Call->getNumArgs() != 0 &&
+        (Call->isAssignmentOp() || Call->getOperator() == OO_PlusPlus ||
+         Call->getOperator() == OO_MinusMinus))
+      Target = Call->getArg(0);
+  } else if (const auto *Call = dyn_cast<CXXMemberCallExpr>(S)) {
+    const auto *Method = Call->getMethodDecl();
+    if (Method && !Method->isConst() && !Method->isStatic())
+      Target = Call->getImplicitObjectArgument();
+  }
+  if (Target)
+    if (const VarDecl *Var = getReferencedVar(Target))
+      if (Vars.contains(Var))
+        return Var;
+  for (const Stmt *Child : S->children())
+    if (const VarDecl *Var = findWrite(Child, Vars))
+      return Var;
+  return nullptr;
+}
+
+// The constant added to Index by the increment of a counted loop.
+static std::optional<std::int64_t> getStep(const Expr *Inc,
+                                           const VarDecl *Index,
+                                           ASTContext &Ctx) {
+  Inc = Inc->IgnoreParenImpCasts();
+  if (const auto *Op = dyn_cast<UnaryOperator>(Inc)) {
+    if (!Op->isIncrementDecrementOp() ||
+        getReferencedVar(Op->getSubExpr()) != Index)
+      return std::nullopt;
+    return Op->isIncrementOp() ? 1 : -1;
+  }
+  const auto *Op = dyn_cast<BinaryOperator>(Inc);
+  if (!Op || getReferencedVar(Op->getLHS()) != Index)
+    return std::nullopt;
+  const Expr *Amount = Op->getRHS();
+  bool Negate = Op->getOpcode() == BO_SubAssign;
+  if (Op->getOpcode() == BO_Assign) {
+    // i = i + C, i = i - C, i = C + i
+    const auto *Sum = dyn_cast<BinaryOperator>(Amount->IgnoreParenImpCasts());
+    if (!Sum || !Sum->isAdditiveOp())
+      return std::nullopt;
+    Negate = Sum->getOpcode() == BO_Sub;
+    if (getReferencedVar(Sum->getLHS()) == Index)
+      Amount = Sum->getRHS();
+    else if (!Negate && getReferencedVar(Sum->getRHS()) == Index)
+      Amount = Sum->getLHS();
+    else
+      return std::nullopt;
+  } else if (Op->getOpcode() != BO_AddAssign && !Negate) {
+    return std::nullopt;
+  }
+  auto Value = Amount->getIntegerConstantExpr(Ctx);
+  if (!Value)
+    return std::nullopt;
+  return Negate ? -Value->getExtValue() : Value->getExtValue();
+}
+
+Expected<CountedLoop> getCountedLoop(const ForStmt &For, ASTContext &Ctx) {
+  CountedLoop Loop{};
+  const auto *Init = dyn_cast_or_null<DeclStmt>(For.getInit());
+  const auto *Index =
+      Init && Init->isSingleDecl() ? dyn_cast<VarDecl>(Init->getSingleDecl())
+                                   : nullptr;
+  if (!Index || !Index->getInit() ||
+      !Index->getType()->isIntegralOrEnumerationType() ||
+      Index->getType()->isBooleanType() || Index->getType()->isEnumeralType())
+    return loopError("the loop must declare a single integer index with an "
+                     "initializer, e.g. 'for (int i = 0; ...)'");
+  Loop.Index = Index;
+  Loop.Begin = Index->getInit();
+
+  const auto *Cond = dyn_cast_or_null<BinaryOperator>(
+      For.getCond() ? For.getCond()->IgnoreParenImpCasts() : nullptr);
+  BinaryOperatorKind Compare = Cond ? Cond->getOpcode() : BO_Comma;
+  if (Cond && getReferencedVar(Cond->getLHS()) == Index) {
+    Loop.End = Cond->getRHS();
+  } else if (Cond && getReferencedVar(Cond->getRHS()) == Index) {
+    Loop.End = Cond->getLHS();
+    Compare = BinaryOperator::reverseComparisonOp(Compare);
+  }
+  if (!Loop.End || !is_contained({BO_LT, BO_LE, BO_GT, BO_GE, BO_NE}, Compare))
+    return loopError("the condition must compare '" + Index->getName() +
+                     "' with '<', '<=', '>', '>=' or '!='");
+  Loop.Inclusive = Compare == BO_LE || Compare == BO_GE;
+
+  auto Step = For.getInc() ? getStep(For.getInc(), Index, Ctx) : std::nullopt;
+  if (!Step || *Step == 0)
+    return loopError("the increment must add a non-zero constant to '" +
+                     Index->getName() + "'");
+  Loop.Step = *Step;
+  bool Up = Compare == BO_LT || Compare == BO_LE;
+  bool Down = Compare == BO_GT || Compare == BO_GE;
+  if ((Up && Loop.Step < 0) || (Down && Loop.Step > 0) ||
+      (Compare == BO_NE && Loop.Step != 1 && Loop.Step != -1))
+    return loopError("the increment of '" + Index->getName() +
+                     "' does not move it towards the bound");
+
+  if (Loop.End->HasSideEffects(Ctx, /*IncludePossibleEffects=*/false))
+    return loopError("the bound must not have side effects");
+  SmallPtrSet<const VarDecl *, 4> Written{Index};
+  if (findWrite(For.getBody(), Written))
+    return loopError("'" + Index->getName() + "' is modified in the body");
+  SmallPtrSet<const VarDecl *, 4> BoundVars;
+  collectReferencedVars(Loop.End, BoundVars);
+  if (const VarDecl *Var = findWrite(For.getBody(), BoundVars))
+    return loopError("the bound depends on '" + Var->getName() +
+                     "', which is modified in the body");
+  return Loop;
+}
+
+// Checks that Nested, the only statement of the body of Loop, can share an
+// iteration space with it.
+static Expected<const Stmt *> getCollapsibleLoop(const Stmt &Loop,
+                                                 const Stmt *Nested,
+                                                 ASTContext &Ctx) {
+  if (!isa_and_nonnull<CXXForRangeStmt, ForStmt>(Nested))
+    return loopError("the body must consist of a single nested loop");
+  // A `for` loop that is not counted is reported on its own.
+  if (const auto *Range = dyn_cast<CXXForRangeStmt>(&Loop))
+    if (!isRandomAccess(classifyRange(*Range, Ctx)))
+      return loopError("the outer loop must iterate over a random-access "
+                       "range");
+
+  SmallPtrSet<const VarDecl *, 4> HeaderVars;
+  if (const auto *Range = dyn_cast<CXXForRangeStmt>(Nested)) {
+    if (!isRandomAccess(classifyRange(*Range, Ctx)))
+      return loopError("the nested loop must iterate over a random-access "
+                       "range");
+    collectReferencedVars(Range->getRangeInit(), HeaderVars);
+  } else {
+    auto Counted = getCountedLoop(*cast<ForStmt>(Nested), Ctx);
+    if (!Counted)
+      return loopError("the nested loop is not a counted loop: " +
+                       toString(Counted.takeError()));
+    collectReferencedVars(Counted->Begin, HeaderVars);
+    collectReferencedVars(Counted->End, HeaderVars);
+  }
+  if (!isa<CompoundStmt>(getLoopBody(*Nested)))
+    return loopError("the nested loop must have a braced body");
+  if (const VarDecl *Var = getLoopVariable(Loop); HeaderVars.contains(Var))
+    return loopError("the iterations of the nested loop depend on '" +
+                     Var->getName() + "'");
+  return Nested;
+}
+
+Expected<const Stmt *> getCollapsedLoop(const Stmt &Loop,
+                                        const ParallelOptions &Opts,
+                                        ASTContext &Ctx) {
+  bool Explicit = Opts.isExplicit("collapse");
+  if (Explicit && Opts.Collapse == 1)
+    return nullptr;
+  const auto *Body = dyn_cast<CompoundStmt>(getLoopBody(Loop));
+  const Stmt *Nested =
+      Body && Body->size() == 1 ? Body->body_front() : nullptr;
+  const AnnotateAttr *NestedParallel = nullptr;
+  if (const auto *Attributed = dyn_cast_or_null<AttributedStmt>(Nested)) {
+    NestedParallel = getParallelAnnotation(*Attributed);
+    Nested = Attributed->getSubStmt();
+  }
+  bool NestedHasArguments =
+      NestedParallel && !getParallelArguments(*NestedParallel).empty();
+
+  if (!Explicit) {
+    if (!NestedParallel || NestedHasArguments)
+      return nullptr;
+    auto Collapsible = getCollapsibleLoop(Loop, Nested, Ctx);
+    if (!Collapsible) {
+      consumeError(Collapsible.takeError());
+      return nullptr;
+    }
+    return Collapsible;
+  }
+  if (NestedHasArguments)
+    return loopError("the nested loop has 'parallel' arguments of its own");
+  return getCollapsibleLoop(Loop, Nested, Ctx);
+}
+
+const VarDecl *getLoopVariable(const Stmt &Loop) {
+  if (const auto *Range = dyn_cast<CXXForRangeStmt>(&Loop))
+    return Range->getLoopVariable();
+  if (const auto *For = dyn_cast<ForStmt>(&Loop))
+    if (const auto *Init = dyn_cast_or_null<DeclStmt>(For->getInit()))
+      if (Init->isSingleDecl())
+        return dyn_cast<VarDecl>(Init->getSingleDecl());
+  return nullptr;
+}
+
+const Stmt *getLoopBody(const Stmt &Loop) {
+  if (const auto *Range = dyn_cast<CXXForRangeStmt>(&Loop))
+    return Range->getBody();
+  return cast<ForStmt>(Loop).getBody();
+}
+
+// Whether Record, or one of its bases, has a `clear()` member function that
+// can be called without arguments.
+static bool hasClearMethod(const CXXRecordDecl *Record, ASTContext &Ctx) {
+  if (!Record || !Record->hasDefinition())
+    return false;
+  for (const auto *Found : Record->lookup(&Ctx.Idents.get("clear"))) {
+    const auto *Method = dyn_cast<CXXMethodDecl>(Found);
+    if (const auto *Template = dyn_cast<FunctionTemplateDecl>(Found))
+      Method = dyn_cast<CXXMethodDecl>(Template->getTemplatedDecl());
+    if (Method && !Method->isStatic() &&
+        Method->getMinRequiredArguments() == 0)
+      return true;
+  }
+  return any_of(Record->bases(), [&](const CXXBaseSpecifier &Base) {
+    return hasClearMethod(Base.getType()->getAsCXXRecordDecl(), Ctx);
+  });
+}
+
+// Whether Record is a standard stream, whose `clear()` resets its state and
+// keeps its contents.
+static bool isStream(const CXXRecordDecl *Record) {
+  if (!Record)
+    return false;
+  if (Record->isInStdNamespace() && Record->getName() == "ios_base")
+    return true;
+  if (!Record->hasDefinition())
+    return false;
+  return any_of(Record->bases(), [](const CXXBaseSpecifier &Base) {
+    return isStream(Base.getType()->getAsCXXRecordDecl());
+  });
+}
+
+Error checkPrivateLocal(const VarDecl &Var) {
+  std::string Name = ("'" + Var.getName() + "'").str();
+  QualType Type = Var.getType();
+  if (!Var.hasLocalStorage())
+    return loopError(Name + " is static");
+  if (Type->isReferenceType())
+    return loopError(Name + " is a reference");
+  if (Type.isConstQualified())
+    return loopError(Name + " is const");
+  const auto *Record = Type->getAsCXXRecordDecl();
+  if (isStream(Record))
+    return loopError("the clear() member function of stream " + Name +
+                     " keeps its contents");
+  if (!hasClearMethod(Record, Var.getASTContext()))
+    return loopError(Name + " has no clear() member function to reuse it");
+  if (const Expr *Init = Var.getInit()) {
+    const auto *Construct = dyn_cast<CXXConstructExpr>(Init->IgnoreImplicit());
+    if (!Construct || Construct->getNumArgs() != 0)
+      return loopError(Name + " is not default-constructed, so clear() does "
+                              "not give it back its initial value");
+  }
+  return Error::success();
+}
+
+Expected<SmallVector<PrivateLocal, 2>>
+getPrivateLocals(const Stmt &Loop, const ParallelOptions &Opts,
+                 ASTContext &Ctx) {
+  SmallVector<PrivateLocal, 2> Locals;
+  if (Opts.Privates.empty())
+    return Locals;
+  const Stmt *Innermost = &Loop;
+  if (auto Nested = getCollapsedLoop(Loop, Opts, Ctx); !Nested)
+    consumeError(Nested.takeError());
+  else if (*Nested)
+    Innermost = *Nested;
+  const auto *Body = dyn_cast<CompoundStmt>(getLoopBody(*Innermost));
+  if (!Body)
+    return loopError("the body of a loop with private variables must be a "
+                     "block");
+  for (const std::string &Name : Opts.Privates) {
+    const DeclStmt *Found = nullptr;
+    const VarDecl *Var = nullptr;
+    for (const Stmt *S : Body->body()) {
+      const auto *Decls = dyn_cast<DeclStmt>(S);
+      if (!Decls)
+        continue;
+      for (const Decl *D : Decls->decls()) {
+        const auto *Candidate = dyn_cast<VarDecl>(D);
+        if (Candidate && Candidate->getIdentifier() &&
+            Candidate->getName() == Name) {
+          Found = Decls;
+          Var = Candidate;
+        }
+      }
+    }
+    if (!Var)
+      return loopError("private variable '" + Name +
+                       "' is not declared by a statement of the loop body");
+    if (!Found->isSingleDecl())
+      return loopError("private variable '" + Name +
+                       "' must be the only variable of its declaration");
+    if (Found->getBeginLoc().isMacroID() || Found->getEndLoc().isMacroID())
+      return loopError("private variable '" + Name +
+                       "' is declared by a macro");
+    if (auto Err = checkPrivateLocal(*Var))
+      return std::move(Err);
+    Locals.push_back({Var, Found});
+  }
+  return Locals;
+}
+
+} // namespace clang::parallel
@@ -0,0 +1,100 @@
+#ifndef PARALLEL_LOOP_ANALYSIS_H
+#define PARALLEL_LOOP_ANALYSIS_H
+#include "ParallelOptions.h"
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/StmtCXX.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/Error.h"
+#include <cstdint>
+
+namespace clang::parallel {
+
+// How the iteration space of a for-range loop can be split among workers.
+enum class RangeKind {
+  // Elements are adjacent in memory, e.g. arrays, std::vector, std::array.
+  Contiguous,
+  // Iterators support constant-time advance, e.g. std::deque.
+  RandomAccess,
+  // Standard unordered containers, whose buckets can be walked independently.
+  Hashed,
+  // Other ranges of forward iterators, e.g. std::list, std::map. Their
+  // elements are stable lvalues, whose addresses can be gathered by a single
+  // walk and then split like an array.
+  Gathered,
+  // Anything else has to be walked to be split.
+  Sequential,
+};
+
+RangeKind classifyRange(const CXXForRangeStmt &For, ASTContext &Ctx);
+
+// Whether the range of For is a standard container whose elements std::data
+// points to, such as std::vector or std::array.
+bool hasContiguousData(const CXXForRangeStmt &For);
+
+inline bool isRandomAccess(RangeKind Kind) {
+  return Kind == RangeKind::Contiguous || Kind == RangeKind::RandomAccess;
+}
+
+// A `for` loop counting an integer index from Begin to an invariant End by a
+// constant step, such as `for (std::size_t i = 0; i < n; ++i)`. The condition
+// compares the index with `<`, `<=`, `>`, `>=` or `!=`, and the increment is
+// `++`, `--`, `+=` or `-=` by a constant.
+struct CountedLoop {
+  const VarDecl *Index;
+  const Expr *Begin;
+  const Expr *End;
+  // Whether the last iteration runs with the index equal to End, as with `<=`
+  // and `>=`.
+  bool Inclusive;
+  // Never 0, negative when counting down.
+  std::int64_t Step;
+};
+
+// Recognizes For as a counted loop, or explains why it is not one.
+llvm::Expected<CountedLoop> getCountedLoop(const ForStmt &For, ASTContext &Ctx);
+
+// The loop flattened with Loop into one iteration space: the only statement of
+// its body, a for-range loop over a random-access range or a counted loop,
+// whose iteration space does not depend on Loop. Null when Loop runs alone.
+//
+// `collapse=2` asks for the nest, and gets an error explaining why it cannot
+// be collapsed. Without a `collapse` clause, a nested `[[parallel]]` loop
+// without arguments is collapsed when it can be.
+llvm::Expected<const Stmt *> getCollapsedLoop(const Stmt &Loop,
+                                              const ParallelOptions &Opts,
+                                              ASTContext &Ctx);
+
+// The variable private to every iteration of a parallel loop: the loop
+// variable of a for-range loop, or the variable declared by the initializer of
+// a `for` loop. Null when there is none.
+const VarDecl *getLoopVariable(const Stmt &Loop);
+
+// The body of a for-range or `for` loop.
+const Stmt *getLoopBody(const Stmt &Loop);
+
+// A local of a parallel loop body named by a `private` clause.
+struct PrivateLocal {
+  const VarDecl *Var;
+  // The statement of the body declaring Var, and nothing else.
+  const DeclStmt *Decl;
+};
+
+// Finds the locals named by the `private` clause of Opts, in the order of the
+// clause, or explains why one of them cannot be private. A private local is
+// declared alone by a statement of the body that runs for every iteration,
+// the body of Loop or of the loop collapsed with it, and passes
+// checkPrivateLocal. Every task then declares it once and calls its `clear()`
+// member function where the body declared it, so that the iterations of a
+// task reuse the memory it owns.
+llvm::Expected<llvm::SmallVector<PrivateLocal, 2>>
+getPrivateLocals(const Stmt &Loop, const ParallelOptions &Opts,
+                 ASTContext &Ctx);
+
+// Checks that Var, a local of a loop body, gets back its initial value from
+// `clear()`: it is a default-constructed class object, neither static nor
+// const, with a `clear()` member function, that is not a stream.
+llvm::Error checkPrivateLocal(const VarDecl &Var);
+
+} // namespace clang::parallel
+
+#endif
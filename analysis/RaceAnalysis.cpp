@@ -0,0 +1,477 @@
+#include "RaceAnalysis.h"
+#include "LoopAnalysis.h"
+
+#include "clang/AST/DeclCXX.h"
+#include "clang/AST/ExprCXX.h"
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/StringSwitch.h"
+
+using namespace llvm;
+
+namespace clang::parallel {
+
+bool isSynchronizedType(QualType Type) {
+  const auto *Record = Type.getNonReferenceType()->getAsCXXRecordDecl();
+  if (!Record || !Record->isInStdNamespace())
+    return false;
+  return StringSwitch<bool>(Record->getName())
+      .Cases("atomic", "atomic_flag", "atomic_ref", true)
+      .Cases("mutex", "recursive_mutex", "timed_mutex", true)
+      .Cases("recursive_timed_mutex", "shared_mutex", "shared_timed_mutex",
+             true)
+      .Cases("condition_variable", "condition_variable_any", true)
+      .Default(false);
+}
+
+const VarDecl *AppendTracker::getAppendTarget(const Stmt &S) {
+  const auto *Call = dyn_cast<CXXMemberCallExpr>(&S);
+  if (!Call)
+    return nullptr;
+  const auto *Method = Call->getMethodDecl();
+  if (!Method || !Method->getIdentifier() ||
+      (Method->getName() != "push_back" && Method->getName() != "emplace_back"))
+    return nullptr;
+  const auto *Ref = dyn_cast<DeclRefExpr>(
+      Call->getImplicitObjectArgument()->IgnoreParenImpCasts());
+  if (!Ref)
+    return nullptr;
+  const auto *Var = dyn_cast<VarDecl>(Ref->getDecl());
+  if (!Var)
+    return nullptr;
+  const auto *Record =
+      Var->getType().getNonReferenceType()->getAsCXXRecordDecl();
+  if (!Record || !Record->isInStdNamespace() ||
+      !StringSwitch<bool>(Record->getName())
+           .Cases("vector", "deque", "list", "basic_string", true)
+           .Default(false))
+    return nullptr;
+  return Var;
+}
+
+AppendTracker::AppendTracker(const Stmt &Loop, const ParallelOptions &Opts)
+    : LoopVar(getLoopVariable(Loop)), Opts(Opts) {}
+
+void AppendTracker::observe(const Decl &D) {
+  if (const auto *Var = dyn_cast<VarDecl>(&D))
+    Locals.insert(Var);
+}
+
+void AppendTracker::observe(const Stmt &S) {
+  if (const VarDecl *Var = getAppendTarget(S)) {
+    const auto *Call = cast<CXXMemberCallExpr>(&S);
+    AppendObjects.insert(
+        Call->getImplicitObjectArgument()->IgnoreParenImpCasts());
+    if (!is_contained(Candidates, Var))
+      Candidates.push_back(Var);
+    return;
+  }
+  if (const auto *Ref = dyn_cast<DeclRefExpr>(&S))
+    if (!AppendObjects.erase(Ref))
+      if (const auto *Var = dyn_cast<VarDecl>(Ref->getDecl()))
+        Disqualified.insert(Var);
+}
+
+SmallVector<const VarDecl *, 2> AppendTracker::getAppends() const {
+  SmallVector<const VarDecl *, 2> Appends;
+  for (const VarDecl *Var : Candidates) {
+    if (Var == LoopVar || Locals.contains(Var) || Disqualified.contains(Var))
+      continue;
+    if (any_of(Opts.Reductions,
+               [&](const Reduction &R) { return Var->getName() == R.Var; }))
+      continue;
+    Appends.push_back(Var);
+  }
+  return Appends;
+}
+
+namespace {
+// Who owns the location an lvalue designates.
+enum class Owner {
+  // Private to the iteration: the loop variable, a local of the body, or a
+  // reduction variable.
+  Iteration,
+  // A variable or member of the enclosing scope.
+  Shared,
+  // An element reached through a pointer or index independent of the
+  // iteration.
+  SharedElement,
+  // An element reached through a pointer or index computed from the
+  // iteration.
+  UnprovenElement,
+  // Anything the analysis does not understand, e.g. a reference returned by
+  // a call. Not reported to keep the diagnostics free of noise.
+  Unknown,
+};
+
+struct Location {
+  Owner Kind;
+  const ValueDecl *Target = nullptr;
+};
+
+} // namespace
+
+// The index of Loop when it is a counted loop, which takes a different value
+// in every iteration. The loop variable of a for-range loop is an element,
+// and several elements may hold the same value.
+static const VarDecl *getIterationIndex(const Stmt &Loop) {
+  const auto *For = dyn_cast<ForStmt>(&Loop);
+  const VarDecl *Var = getLoopVariable(Loop);
+  if (!For || !Var)
+    return nullptr;
+  auto Counted = getCountedLoop(*For, Var->getASTContext());
+  if (!Counted) {
+    consumeError(Counted.takeError());
+    return nullptr;
+  }
+  return Counted->Index;
+}
+
+class DataRaceTracker::Impl {
+public:
+  Impl(const Stmt &Loop, const ParallelOptions &Opts)
+      : LoopVar(getLoopVariable(Loop)), Index(getIterationIndex(Loop)),
+        Opts(Opts), Appends(Loop, Opts) {
+    if (LoopVar)
+      Locals.insert(LoopVar);
+  }
+
+  SmallVector<RaceFinding, 4> Findings;
+  AppendTracker Appends;
+
+  void observe(const Decl &D) {
+    Appends.observe(D);
+    if (const auto *Var = dyn_cast<VarDecl>(&D))
+      Locals.insert(Var);
+  }
+
+  void observe(const Stmt &S) {
+    Appends.observe(S);
+    if (const auto *Op = dyn_cast<BinaryOperator>(&S))
+      visitBinaryOperator(Op);
+    else if (const auto *Op = dyn_cast<UnaryOperator>(&S))
+      visitUnaryOperator(Op);
+    else if (const auto *Call = dyn_cast<CXXOperatorCallExpr>(&S))
+      visitCXXOperatorCallExpr(Call);
+    else if (const auto *Call = dyn_cast<CXXMemberCallExpr>(&S))
+      visitCXXMemberCallExpr(Call);
+  }
+
+private:
+  const VarDecl *LoopVar;
+  // Null for a for-range loop, see getIterationIndex.
+  const VarDecl *Index;
+  const ParallelOptions &Opts;
+  SmallPtrSet<const ValueDecl *, 16> Locals;
+
+  void visitBinaryOperator(const BinaryOperator *Op) {
+    if (!Op->isAssignmentOp())
+      return;
+    StringRef SuggestedOp;
+    bool Update = Op->isCompoundAssignmentOp();
+    if (Update)
+      SuggestedOp = reductionFor(Op->getOpcode());
+    else
+      Update = isSelfUpdate(Op->getLHS(), Op->getRHS(), SuggestedOp);
+    checkWrite(Op, Op->getLHS(), Update, SuggestedOp);
+  }
+
+  void visitUnaryOperator(const UnaryOperator *Op) {
+    if (Op->isIncrementDecrementOp())
+      checkWrite(Op, Op->getSubExpr(), /*Update=*/true, "+");
+  }
+
+  void visitCXXOperatorCallExpr(const CXXOperatorCallExpr *Call) {
+    OverloadedOperatorKind Kind = Call->getOperator();
+    if (Call->getNumArgs() == 0)
+      return;
+    if (Kind == OO_PlusPlus || Kind == OO_MinusMinus)
+      checkWrite(Call, Call->getArg(0), /*Update=*/true, "+");
+    else if (Kind == OO_Equal && Call->getNumArgs() == 2) {
+      StringRef SuggestedOp;
+      bool Update =
+          isSelfUpdate(Call->getArg(0), Call->getArg(1), SuggestedOp);
+      checkWrite(Call, Call->getArg(0), Update, SuggestedOp);
+    } else if (Call->isAssignmentOp())
+      checkWrite(Call, Call->getArg(0), /*Update=*/true,
+                 Kind == OO_PlusEqual || Kind == OO_MinusEqual ? "+"
+                 : Kind == OO_StarEqual                        ? "*"
+                                                               : "");
+  }
+
+  void visitCXXMemberCallExpr(const CXXMemberCallExpr *Call) {
+    const auto *Method = Call->getMethodDecl();
+    const Expr *Object = Call->getImplicitObjectArgument();
+    if (!Method || !Object || Method->isStatic() || Method->isConst())
+      return;
+    if (isSynchronizedType(Object->getType()))
+      return;
+    Location Loc = classify(Object);
+    if (Loc.Kind == Owner::Shared || Loc.Kind == Owner::SharedElement)
+      Findings.push_back({RaceFinding::SharedMutatingCall, Call, Loc.Target,
+                          Method});
+    else if (Loc.Kind == Owner::UnprovenElement)
+      Findings.push_back(
+          {RaceFinding::UnprovenElementWrite, Call, Loc.Target, Method});
+  }
+
+  static StringRef reductionFor(BinaryOperatorKind Kind) {
+    switch (Kind) {
+    case BO_AddAssign:
+    case BO_SubAssign:
+      return "+";
+    case BO_MulAssign:
+      return "*";
+    default:
+      return "";
+    }
+  }
+
+  static const ValueDecl *getReferencedDecl(const Expr *E) {
+    if (const auto *Ref = dyn_cast<DeclRefExpr>(E->IgnoreParenCasts()))
+      return Ref->getDecl();
+    return nullptr;
+  }
+
+  // Recognizes `x = x + y`, `x = x * y`, `x = std::min(x, y)` and
+  // `x = std::max(x, y)`, which accumulate just like compound assignments.
+  static bool isSelfUpdate(const Expr *LHS, const Expr *RHS,
+                           StringRef &SuggestedOp) {
+    const ValueDecl *Var = getReferencedDecl(LHS);
+    if (!Var)
+      return false;
+    RHS = RHS->IgnoreParenCasts();
+    if (const auto *Op = dyn_cast<BinaryOperator>(RHS)) {
+      if (Op->getOpcode() != BO_Add && Op->getOpcode() != BO_Mul)
+        return false;
+      if (getReferencedDecl(Op->getLHS()) != Var &&
+          getReferencedDecl(Op->getRHS()) != Var)
+        return false;
+      SuggestedOp = Op->getOpcode() == BO_Add ? "+" : "*";
+      return true;
+    }
+    if (const auto *Call = dyn_cast<CallExpr>(RHS)) {
+      const auto *Callee = Call->getDirectCallee();
+      if (!Callee || !Callee->isInStdNamespace() || !Callee->getIdentifier() ||
+          (Callee->getName() != "min" && Callee->getName() != "max"))
+        return false;
+      if (none_of(Call->arguments(), [&](const Expr *Arg) {
+            return getReferencedDecl(Arg) == Var;
+          }))
+        return false;
+      SuggestedOp = Callee->getName() == "min" ? "min" : "max";
+      return true;
+    }
+    return false;
+  }
+
+  bool isPrivate(const ValueDecl *Var) const {
+    if (Locals.contains(Var))
+      return true;
+    return any_of(Opts.Reductions, [&](const Reduction &R) {
+      return Var->getIdentifier() && Var->getName() == R.Var;
+    });
+  }
+
+  // Whether E is the index of a counted loop, possibly offset by a constant.
+  // The index differs between iterations, so indexing with it gives every
+  // iteration its own element.
+  bool isIterationIndex(const Expr *E) const {
+    E = E->IgnoreParenCasts();
+    if (Index && getReferencedDecl(E) == Index)
+      return true;
+    if (const auto *Op = dyn_cast<BinaryOperator>(E))
+      if (Op->isAdditiveOp())
+        return (isIterationIndex(Op->getLHS()) &&
+                isa<IntegerLiteral>(Op->getRHS()->IgnoreParenCasts())) ||
+               (isIterationIndex(Op->getRHS()) &&
+                isa<IntegerLiteral>(Op->getLHS()->IgnoreParenCasts()));
+    return false;
+  }
+
+  bool referencesPrivate(const Stmt *S) const {
+    if (!S)
+      return false;
+    if (const auto *Ref = dyn_cast<DeclRefExpr>(S))
+      if (isPrivate(Ref->getDecl()))
+        return true;
+    return any_of(S->children(),
+                  [&](const Stmt *Child) { return referencesPrivate(Child); });
+  }
+
+  Location classify(const Expr *E) const {
+    E = E->IgnoreParenCasts();
+    if (isa<CXXThisExpr>(E))
+      return {Owner::Shared};
+    if (const auto *Ref = dyn_cast<DeclRefExpr>(E)) {
+      const auto *Var = dyn_cast<VarDecl>(Ref->getDecl());
+      if (!Var)
+        return {Owner::Unknown};
+      return {isPrivate(Var) ? Owner::Iteration : Owner::Shared, Var};
+    }
+    if (const auto *Member = dyn_cast<MemberExpr>(E)) {
+      const Expr *Base = Member->getBase()->IgnoreParenCasts();
+      if (isa<CXXThisExpr>(Base))
+        return {Owner::Shared, Member->getMemberDecl()};
+      if (Member->isArrow())
+        return classifyPointee(Base);
+      return classify(Base);
+    }
+    if (const auto *Subscript = dyn_cast<ArraySubscriptExpr>(E))
+      return classifyElement(Subscript->getBase(), Subscript->getIdx());
+    if (const auto *Call = dyn_cast<CXXOperatorCallExpr>(E)) {
+      if (Call->getOperator() == OO_Subscript && Call->getNumArgs() == 2)
+        return classifyElement(Call->getArg(0), Call->getArg(1));
+      if (Call->getOperator() == OO_Star && Call->getNumArgs() == 1)
+        return classifyPointee(Call->getArg(0));
+      return {Owner::Unknown};
+    }
+    if (const auto *Op = dyn_cast<UnaryOperator>(E))
+      if (Op->getOpcode() == UO_Deref)
+        return classifyPointee(Op->getSubExpr());
+    return {Owner::Unknown};
+  }
+
+  Location classifyElement(const Expr *Base, const Expr *Subscript) const {
+    // The elements a pointer designates are not owned by the pointer.
+    Location Container = Base->IgnoreParenCasts()->getType()->isPointerType()
+                             ? classifyPointee(Base)
+                             : classify(Base);
+    if (Container.Kind == Owner::Iteration || isIterationIndex(Subscript))
+      return {Owner::Iteration, Container.Target};
+    if (Container.Kind == Owner::Unknown && referencesPrivate(Base))
+      return {Owner::Unknown};
+    if (Container.Kind == Owner::UnprovenElement ||
+        referencesPrivate(Subscript))
+      return {Owner::UnprovenElement, Container.Target};
+    return {Owner::SharedElement, Container.Target};
+  }
+
+  Location classifyPointee(const Expr *Pointer) const {
+    Pointer = Pointer->IgnoreParenCasts();
+    if (isIterationIndex(Pointer))
+      return {Owner::Iteration};
+    if (const auto *Var = getReferencedDecl(Pointer)) {
+      // Several elements of a for-range loop may point to the same object.
+      if (Var == LoopVar && Var != Index)
+        return {Owner::UnprovenElement};
+      if (isPrivate(Var))
+        return {Owner::Iteration, Var};
+      return {Owner::SharedElement, Var};
+    }
+    if (referencesPrivate(Pointer))
+      return {Owner::UnprovenElement};
+    return {Owner::Unknown};
+  }
+
+  void checkWrite(const Expr *Access, const Expr *LValue, bool Update,
+                  StringRef SuggestedOp) {
+    if (isSynchronizedType(LValue->getType()))
+      return;
+    Location Loc = classify(LValue);
+    switch (Loc.Kind) {
+    case Owner::Shared:
+      if (Update)
+        Findings.push_back({RaceFinding::SharedUpdate, Access, Loc.Target,
+                            nullptr, SuggestedOp});
+      else
+        Findings.push_back({RaceFinding::SharedWrite, Access, Loc.Target});
+      break;
+    case Owner::SharedElement:
+      Findings.push_back(
+          {RaceFinding::SharedElementWrite, Access, Loc.Target});
+      break;
+    case Owner::UnprovenElement:
+      Findings.push_back(
+          {RaceFinding::UnprovenElementWrite, Access, Loc.Target});
+      break;
+    case Owner::Iteration:
+    case Owner::Unknown:
+      break;
+    }
+  }
+};
+
+DataRaceTracker::DataRaceTracker(const Stmt &Loop,
+                                 const ParallelOptions &Opts)
+    : Pimpl(std::make_unique<Impl>(Loop, Opts)) {}
+
+DataRaceTracker::~DataRaceTracker() = default;
+
+void DataRaceTracker::observe(const Decl &D) { Pimpl->observe(D); }
+
+void DataRaceTracker::observe(const Stmt &S) { Pimpl->observe(S); }
+
+SmallVector<RaceFinding, 4> DataRaceTracker::takeFindings() {
+  // Appends only race until the containers are known to be private to each
+  // task, which takes the whole body.
+  SmallVector<const VarDecl *, 2> Appends = Pimpl->Appends.getAppends();
+  SmallVector<RaceFinding, 4> Findings = std::move(Pimpl->Findings);
+  llvm::erase_if(Findings, [&](const RaceFinding &Finding) {
+    return is_contained(Appends, Finding.Target);
+  });
+  return Findings;
+}
+
+SmallVector<const VarDecl *, 2> DataRaceTracker::getOrderedAppends() const {
+  return Pimpl->Appends.getAppends();
+}
+
+namespace {
+class RaceFinder : public RecursiveASTVisitor<RaceFinder> {
+public:
+  explicit RaceFinder(DataRaceTracker &Tracker) : Tracker(Tracker) {}
+
+  bool VisitDecl(Decl *D) {
+    Tracker.observe(*D);
+    return true;
+  }
+
+  bool VisitStmt(Stmt *S) {
+    Tracker.observe(*S);
+    return true;
+  }
+
+private:
+  DataRaceTracker &Tracker;
+};
+} // namespace
+
+SmallVector<RaceFinding, 4> findDataRaces(const Stmt &Loop,
+                                          const ParallelOptions &Opts) {
+  DataRaceTracker Tracker(Loop, Opts);
+  RaceFinder Finder(Tracker);
+  Finder.TraverseStmt(const_cast<Stmt *>(getLoopBody(Loop)));
+  return Tracker.takeFindings();
+}
+
+namespace {
+class AppendFinder : public RecursiveASTVisitor<AppendFinder> {
+public:
+  explicit AppendFinder(AppendTracker &Tracker) : Tracker(Tracker) {}
+
+  bool VisitDecl(Decl *D) {
+    Tracker.observe(*D);
+    return true;
+  }
+
+  bool VisitStmt(Stmt *S) {
+    Tracker.observe(*S);
+    return true;
+  }
+
+private:
+  AppendTracker &Tracker;
+};
+} // namespace
+
+SmallVector<const VarDecl *, 2>
+findOrderedAppends(const Stmt &Loop, const ParallelOptions &Opts) {
+  AppendTracker Tracker(Loop, Opts);
+  AppendFinder Finder(Tracker);
+  Finder.TraverseStmt(const_cast<Stmt *>(getLoopBody(Loop)));
+  return Tracker.getAppends();
+}
+
+} // namespace clang::parallel
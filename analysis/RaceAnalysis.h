@@ -0,0 +1,110 @@
+#ifndef PARALLEL_RACE_ANALYSIS_H
+#define PARALLEL_RACE_ANALYSIS_H
+#include "ParallelOptions.h"
+#include "clang/AST/Decl.h"
+#include "clang/AST/Expr.h"
+#include "clang/AST/StmtCXX.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include <memory>
+
+namespace clang::parallel {
+
+// A write in the body of a parallel loop that may race with the same write
+// of another iteration once the body runs in a `[&]` lambda.
+struct RaceFinding {
+  enum KindT {
+    // A variable of the enclosing scope is assigned by every iteration.
+    SharedWrite,
+    // A variable of the enclosing scope is accumulated into, e.g. `sum += x`.
+    SharedUpdate,
+    // A write through a pointer or an index that does not depend on the
+    // iteration, so every iteration writes the same location.
+    SharedElementWrite,
+    // A write through a pointer or an index computed from the iteration,
+    // which may still collide between iterations, e.g. `hist[x % 16]++`.
+    UnprovenElementWrite,
+    // A non-const member function called on an object of the enclosing scope.
+    SharedMutatingCall,
+  };
+  KindT Kind;
+  // The assignment, increment or call performing the write.
+  const Expr *Access;
+  // The variable written, or the object the member function is called on.
+  // Null when it is not a named variable.
+  const ValueDecl *Target = nullptr;
+  // The member function of a SharedMutatingCall.
+  const CXXMethodDecl *Method = nullptr;
+  // Reduction operator matching a SharedUpdate, e.g. "+" for `sum += x`.
+  // Empty when the update is not a supported reduction.
+  llvm::StringRef SuggestedOp;
+};
+
+// Whether Type is a standard atomic, mutex or condition variable, whose
+// members are meant to be used concurrently.
+bool isSynchronizedType(QualType Type);
+
+// Finds the writes in the body of Loop, a for-range or counted `for` loop, to
+// memory that is not private to the iteration. Variables named in a `reduce`
+// clause of Opts are private, and so are the containers the body only appends
+// to, see findOrderedAppends.
+llvm::SmallVector<RaceFinding, 4> findDataRaces(const Stmt &Loop,
+                                                const ParallelOptions &Opts);
+
+// Finds the standard sequence containers of the enclosing scope that the body
+// of Loop only appends to, as in `out.push_back(f(x))`: every use of such a
+// container is a `push_back` or `emplace_back` call on it, and its arguments
+// do not use it. Each task can then append to a private container, and the
+// parts are appended to the original one in the order of the iterations.
+// Variables named in a `reduce` clause of Opts are not containers appended to.
+// The containers are returned in the order of their first append.
+llvm::SmallVector<const VarDecl *, 2>
+findOrderedAppends(const Stmt &Loop, const ParallelOptions &Opts);
+
+// Incremental form of findOrderedAppends, observing the body in pre-order
+// like DataRaceTracker.
+class AppendTracker {
+public:
+  AppendTracker(const Stmt &Loop, const ParallelOptions &Opts);
+
+  void observe(const Decl &D);
+  void observe(const Stmt &S);
+  llvm::SmallVector<const VarDecl *, 2> getAppends() const;
+
+  // The container S calls `push_back` or `emplace_back` on, when it is a
+  // standard sequence container named by a variable. Null otherwise.
+  static const VarDecl *getAppendTarget(const Stmt &S);
+
+private:
+  const VarDecl *LoopVar;
+  const ParallelOptions &Opts;
+  llvm::SmallPtrSet<const VarDecl *, 8> Locals;
+  llvm::SmallVector<const VarDecl *, 2> Candidates;
+  llvm::SmallPtrSet<const VarDecl *, 2> Disqualified;
+  // References to the container of append calls, which are observed after
+  // the call itself and are not uses of their own.
+  llvm::SmallPtrSet<const Expr *, 4> AppendObjects;
+};
+
+// Incremental form of findDataRaces for callers that already walk the body:
+// every declaration and statement of the body has to be observed in
+// pre-order, as RecursiveASTVisitor visits them.
+class DataRaceTracker {
+public:
+  DataRaceTracker(const Stmt &Loop, const ParallelOptions &Opts);
+  ~DataRaceTracker();
+
+  void observe(const Decl &D);
+  void observe(const Stmt &S);
+  llvm::SmallVector<RaceFinding, 4> takeFindings();
+  // The containers of findOrderedAppends, once the whole body was observed.
+  llvm::SmallVector<const VarDecl *, 2> getOrderedAppends() const;
+
+private:
+  class Impl;
+  std::unique_ptr<Impl> Pimpl;
+};
+
+} // namespace clang::parallel
+
+#endif
@@ -0,0 +1,223 @@
+#include "VectorizeAnalysis.h"
+#include "LoopAnalysis.h"
+
+#include "clang/AST/DeclCXX.h"
+#include "clang/AST/ExprCXX.h"
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "clang/Basic/Builtins.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringSwitch.h"
+
+using namespace llvm;
+
+namespace clang::parallel {
+
+// RAII owners of a mutex, which lock it for their lifetime.
+static bool isLockType(QualType Type) {
+  const auto *Record = Type.getNonReferenceType()->getAsCXXRecordDecl();
+  if (!Record || !Record->isInStdNamespace())
+    return false;
+  return StringSwitch<bool>(Record->getName())
+      .Cases("lock_guard", "unique_lock", "scoped_lock", "shared_lock", true)
+      .Default(false);
+}
+
+// Whether Callee is one of the allocation functions of the C library.
+static bool isAllocationFunction(const FunctionDecl &Callee) {
+  switch (Callee.getBuiltinID()) {
+  case Builtin::BImalloc:
+  case Builtin::BIcalloc:
+  case Builtin::BIrealloc:
+  case Builtin::BIfree:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static bool isTransparent(const FunctionDecl &Callee,
+                          DenseMap<const FunctionDecl *, bool> &Known);
+
+namespace {
+// Walks the body of a callee for anything that would block running the loop
+// calling it unsequenced.
+class CalleeWalker : public RecursiveASTVisitor<CalleeWalker> {
+public:
+  explicit CalleeWalker(DenseMap<const FunctionDecl *, bool> &Known)
+      : Known(Known) {}
+
+  bool Blocked = false;
+
+  // Defaulted members and member initializers call functions too.
+  bool shouldVisitImplicitCode() const { return true; }
+
+  bool VisitVarDecl(VarDecl *Var) {
+    QualType Type = Var->getType();
+    Blocked = isSynchronizedType(Type) || isLockType(Type) ||
+              Type.isDestructedType() == QualType::DK_cxx_destructor;
+    return !Blocked;
+  }
+
+  bool VisitStmt(Stmt *S) {
+    if (isa<CXXNewExpr, CXXDeleteExpr, CXXThrowExpr, CXXTryStmt, AsmStmt>(S))
+      Blocked = true;
+    else if (const auto *Ref = dyn_cast<DeclRefExpr>(S))
+      Blocked = isSynchronizedType(Ref->getDecl()->getType());
+    else if (const auto *Member = dyn_cast<MemberExpr>(S))
+      Blocked = isSynchronizedType(Member->getMemberDecl()->getType());
+    else if (const auto *Call = dyn_cast<CallExpr>(S))
+      Blocked = !Call->getDirectCallee() ||
+                isAllocationFunction(*Call->getDirectCallee()) ||
+                !isTransparent(*Call->getDirectCallee(), Known);
+    else if (const auto *Construct = dyn_cast<CXXConstructExpr>(S))
+      Blocked = !isTransparent(*Construct->getConstructor(), Known);
+    return !Blocked;
+  }
+
+private:
+  DenseMap<const FunctionDecl *, bool> &Known;
+};
+} // namespace
+
+// Whether a call to Callee may run unsequenced. Builtins of the C library,
+// such as printf or memcpy, only may when they are const. Other functions
+// must be trivial, or inline with a body that recursively allocates,
+// synchronizes and calls nothing that may not, which keeps out the members
+// of std:: containers, strings and streams that allocate or lock.
+static bool isTransparent(const FunctionDecl &Callee,
+                          DenseMap<const FunctionDecl *, bool> &Known) {
+  if (const auto *Method = dyn_cast<CXXMethodDecl>(&Callee))
+    if (Method->isVirtual())
+      return false;
+  if (unsigned ID = Callee.getBuiltinID()) {
+    const Builtin::Context &Builtins = Callee.getASTContext().BuiltinInfo;
+    return !Builtins.isPredefinedLibFunction(ID) || Builtins.isConst(ID);
+  }
+  if (Callee.isTrivial())
+    return true;
+  const FunctionDecl *Definition = Callee.getDefinition();
+  if (!Callee.isInlined() || !Definition || !Definition->getBody())
+    return false;
+  // Recursive calls are taken as opaque while the body is walked.
+  auto [It, Inserted] = Known.try_emplace(Definition, false);
+  if (!Inserted)
+    return It->second;
+  CalleeWalker Walker(Known);
+  Walker.TraverseDecl(const_cast<FunctionDecl *>(Definition));
+  return Known[Definition] = !Walker.Blocked;
+}
+
+void VectorizeChecker::observe(const Decl &D) {
+  Races.observe(D);
+  const auto *Var = dyn_cast<VarDecl>(&D);
+  if (!Var)
+    return;
+  Locals.insert(Var);
+  QualType Type = Var->getType();
+  if (isSynchronizedType(Type) || isLockType(Type))
+    Blockers.push_back(
+        {VectorizeBlocker::Synchronization, Var->getLocation(), Var});
+  else if (Type.isDestructedType() == QualType::DK_cxx_destructor)
+    Blockers.push_back({VectorizeBlocker::Allocation, Var->getLocation(), Var});
+}
+
+void VectorizeChecker::observe(const Stmt &S) {
+  Races.observe(S);
+  if (isa<CXXNewExpr, CXXDeleteExpr>(S)) {
+    Blockers.push_back({VectorizeBlocker::Allocation, S.getBeginLoc()});
+    return;
+  }
+  if (isa<CXXThrowExpr, CXXTryStmt>(S)) {
+    Blockers.push_back({VectorizeBlocker::Exception, S.getBeginLoc()});
+    return;
+  }
+  if (isa<AsmStmt>(S)) {
+    Blockers.push_back({VectorizeBlocker::InlineAsm, S.getBeginLoc()});
+    return;
+  }
+  // Locals of the body are reported at their declaration.
+  if (const auto *Ref = dyn_cast<DeclRefExpr>(&S)) {
+    const auto *Var = dyn_cast<VarDecl>(Ref->getDecl());
+    if (Var && !Locals.contains(Var) && isSynchronizedType(Var->getType()))
+      Blockers.push_back(
+          {VectorizeBlocker::Synchronization, Ref->getLocation(), Var});
+    return;
+  }
+  if (const auto *Member = dyn_cast<MemberExpr>(&S)) {
+    const auto *Field = dyn_cast<FieldDecl>(Member->getMemberDecl());
+    if (Field && isSynchronizedType(Field->getType()))
+      Blockers.push_back(
+          {VectorizeBlocker::Synchronization, Member->getMemberLoc(), Field});
+    return;
+  }
+  // Kept when the container turns out to be appended to only, and reported
+  // as a dependence by the race analysis otherwise.
+  if (const VarDecl *Container = AppendTracker::getAppendTarget(S)) {
+    Blockers.push_back({VectorizeBlocker::Append, S.getBeginLoc(), Container});
+    return;
+  }
+  if (const auto *Call = dyn_cast<CallExpr>(&S)) {
+    const FunctionDecl *Callee = Call->getDirectCallee();
+    if (Callee && isAllocationFunction(*Callee))
+      Blockers.push_back(
+          {VectorizeBlocker::Allocation, Call->getExprLoc(), Callee});
+    else if (!Callee || !isTransparent(*Callee, Transparent))
+      Blockers.push_back(
+          {VectorizeBlocker::OpaqueCall, Call->getExprLoc(), Callee});
+    return;
+  }
+  if (const auto *Construct = dyn_cast<CXXConstructExpr>(&S)) {
+    const CXXConstructorDecl *Ctor = Construct->getConstructor();
+    if (!isTransparent(*Ctor, Transparent))
+      Blockers.push_back(
+          {VectorizeBlocker::OpaqueCall, Construct->getLocation(), Ctor});
+  }
+}
+
+SmallVector<VectorizeBlocker, 4> VectorizeChecker::takeBlockers() {
+  SmallVector<const VarDecl *, 2> Appends = Races.getOrderedAppends();
+  llvm::erase_if(Blockers, [&](const VectorizeBlocker &Blocker) {
+    return Blocker.Kind == VectorizeBlocker::Append &&
+           !is_contained(Appends, Blocker.Decl);
+  });
+  for (const auto &Finding : Races.takeFindings())
+    Blockers.push_back({VectorizeBlocker::Dependence,
+                        Finding.Access->getExprLoc(), Finding.Target});
+  // The body is observed in source order, but dependences are only known
+  // once all of it was.
+  llvm::stable_sort(Blockers,
+                    [](const VectorizeBlocker &A, const VectorizeBlocker &B) {
+                      return A.Loc < B.Loc;
+                    });
+  return std::move(Blockers);
+}
+
+namespace {
+class BlockerFinder : public RecursiveASTVisitor<BlockerFinder> {
+public:
+  explicit BlockerFinder(VectorizeChecker &Checker) : Checker(Checker) {}
+
+  bool VisitDecl(Decl *D) {
+    Checker.observe(*D);
+    return true;
+  }
+
+  bool VisitStmt(Stmt *S) {
+    Checker.observe(*S);
+    return true;
+  }
+
+private:
+  VectorizeChecker &Checker;
+};
+} // namespace
+
+SmallVector<VectorizeBlocker, 4>
+findVectorizeBlockers(const Stmt &Loop, const ParallelOptions &Opts) {
+  VectorizeChecker Checker(Loop, Opts);
+  BlockerFinder Finder(Checker);
+  Finder.TraverseStmt(const_cast<Stmt *>(getLoopBody(Loop)));
+  return Checker.takeBlockers();
+}
+
+} // namespace clang::parallel
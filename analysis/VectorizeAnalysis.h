@@ -0,0 +1,74 @@
+#ifndef PARALLEL_VECTORIZE_ANALYSIS_H
+#define PARALLEL_VECTORIZE_ANALYSIS_H
+#include "ParallelOptions.h"
+#include "RaceAnalysis.h"
+#include "clang/AST/Decl.h"
+#include "clang/AST/StmtCXX.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+
+namespace clang::parallel {
+
+// Something in the body of a parallel loop that forbids running it
+// unsequenced. Under `par_unseq` or `#pragma omp simd`, iterations interleave
+// on a single thread, so the body must not synchronize, allocate or run code
+// the compiler cannot see, and no iteration may depend on another.
+struct VectorizeBlocker {
+  enum KindT {
+    // A call to a function that is neither trivial, a builtin, nor inline
+    // with a body that may run unsequenced, to a builtin of the C library
+    // that is not const, or a virtual call.
+    OpaqueCall,
+    // A use of an atomic, a mutex or a lock.
+    Synchronization,
+    // `new`, `delete`, a call to `malloc`, `calloc`, `realloc` or `free`, or
+    // a local whose type has a non-trivial destructor.
+    Allocation,
+    // `throw` or `try`.
+    Exception,
+    // Inline assembly.
+    InlineAsm,
+    // A write another iteration may read or write, see findDataRaces.
+    Dependence,
+    // An append to a container kept in the order of the iterations, see
+    // findOrderedAppends.
+    Append,
+  };
+  KindT Kind;
+  SourceLocation Loc;
+  // The function called, the variable used or declared, or the variable
+  // written. Null when there is none or it is not named.
+  const NamedDecl *Decl = nullptr;
+};
+
+// Finds what keeps the body of Loop, a for-range or counted `for` loop, from
+// running unsequenced, in source order. Empty when the body can use
+// `par_unseq`.
+llvm::SmallVector<VectorizeBlocker, 4>
+findVectorizeBlockers(const Stmt &Loop, const ParallelOptions &Opts);
+
+// Incremental form of findVectorizeBlockers, observing the body the same way
+// as DataRaceTracker.
+class VectorizeChecker {
+public:
+  VectorizeChecker(const Stmt &Loop, const ParallelOptions &Opts)
+      : Races(Loop, Opts) {}
+
+  void observe(const Decl &D);
+  void observe(const Stmt &S);
+  llvm::SmallVector<VectorizeBlocker, 4> takeBlockers();
+
+private:
+  DataRaceTracker Races;
+  // Variables declared in the body.
+  llvm::SmallPtrSet<const VarDecl *, 8> Locals;
+  llvm::SmallVector<VectorizeBlocker, 4> Blockers;
+  // Whether calls to the functions whose bodies were walked may run
+  // unsequenced.
+  llvm::DenseMap<const FunctionDecl *, bool> Transparent;
+};
+
+} // namespace clang::parallel
+
+#endif
@@ -1,6 +1,7 @@
 #include "clang/AST/ASTContext.h"
 #include "clang/AST/Attr.h"
 #include "clang/AST/Attrs.inc"
+#include "clang/AST/Expr.h"
 #include "clang/AST/Stmt.h"
 #include "clang/Basic/Diagnostic.h"
 #include "clang/Basic/DiagnosticSema.h"
@@ -23,16 +24,17 @@ struct ParallelAttrInfo : public ParsedAttrInfo {
                             const Decl *D) const override {
     S.Diag(Attr.getLoc(), diag::err_attribute_wrong_decl_type_str)
         << Attr << Attr.isRegularKeywordAttribute()
-        << "for-range(C++11) loop statements";
+        << "for-range(C++11) and counted for loop statements";
     return false;
   }
 
   bool diagAppertainsToStmt(Sema &S, const ParsedAttr &Attr,
                             const Stmt *St) const override {
-    if (!isa<CXXForRangeStmt>(St)) {
+    // Whether a `for` loop is a counted one is checked by the lint plugin.
+    if (!isa<CXXForRangeStmt, ForStmt>(St)) {
       S.Diag(Attr.getLoc(), diag::err_attribute_wrong_decl_type_str)
           << Attr << Attr.isRegularKeywordAttribute()
-          << "for-range(C++11) loop statements";
+          << "for-range(C++11) and counted for loop statements";
       static auto id =
           S.Diags.getCustomDiagID(DiagnosticsEngine::Note, "not '%0'");
       S.Diag(St->getBeginLoc(), id) << St->getStmtClassName();
@@ -43,8 +45,23 @@ struct ParallelAttrInfo : public ParsedAttrInfo {
 
   AttrHandling handleStmtAttribute(Sema &S, Stmt *St, const ParsedAttr &Attr,
                                    class Attr *&Result) const override {
-    Result = AnnotateAttr::Create(S.Context, "parallel", nullptr, 0,
-                                  Attr.getRange());
+    // Clauses are spelled as string literals, e.g.
+    // [[parallel("policy=par_unseq", "grain=4096")]], and are kept as the
+    // arguments of the annotation for the lint plugin and the transformer.
+    SmallVector<Expr *, 4> Args;
+    for (unsigned I = 0, E = Attr.getNumArgs(); I != E; ++I) {
+      Expr *Arg = Attr.isArgExpr(I) ? Attr.getArgAsExpr(I) : nullptr;
+      if (!Arg || !isa<StringLiteral>(Arg->IgnoreParenCasts())) {
+        static auto id = S.Diags.getCustomDiagID(
+            DiagnosticsEngine::Error,
+            "'parallel' attribute arguments must be string literals");
+        S.Diag(Arg ? Arg->getExprLoc() : Attr.getLoc(), id);
+        return AttributeNotApplied;
+      }
+      Args.push_back(Arg);
+    }
+    Result = AnnotateAttr::Create(S.Context, "parallel", Args.data(),
+                                  Args.size(), Attr.getRange());
     return AttributeApplied;
   }
 };
@@ -0,0 +1,310 @@
+#include "ParallelOptions.h"
+
+#include "clang/AST/Expr.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/ADT/Twine.h"
+#include <optional>
+
+using namespace llvm;
+
+namespace clang::parallel {
+
+static Error clauseError(const Twine &Message) {
+  return make_error<StringError>(Message, inconvertibleErrorCode());
+}
+
+namespace {
+// A clause is spelled either `name`, `name=value` or `name(arguments)`.
+struct Clause {
+  StringRef Name;
+  std::optional<StringRef> Value;
+  std::optional<StringRef> Arguments;
+};
+} // namespace
+
+static Expected<Clause> splitClause(StringRef Text) {
+  Text = Text.trim();
+  Clause C;
+  size_t Pos = Text.find_first_of("=(");
+  C.Name = Text.substr(0, Pos).trim();
+  if (C.Name.empty())
+    return clauseError("expected a clause name in '" + Text + "'");
+  if (Pos == StringRef::npos)
+    return C;
+  if (Text[Pos] == '=') {
+    C.Value = Text.substr(Pos + 1).trim();
+    if (C.Value->empty())
+      return clauseError("missing value for clause '" + C.Name + "'");
+    return C;
+  }
+  if (!Text.ends_with(")"))
+    return clauseError("unbalanced parentheses in clause '" + C.Name + "'");
+  C.Arguments = Text.drop_back().substr(Pos + 1).trim();
+  return C;
+}
+
+static Expected<StringRef> requireValue(const Clause &C) {
+  if (!C.Value)
+    return clauseError("clause '" + C.Name + "' expects the form '" + C.Name +
+                       "=<value>'");
+  return *C.Value;
+}
+
+static Error parsePolicy(const Clause &C, ParallelOptions &Opts) {
+  auto Value = requireValue(C);
+  if (!Value)
+    return Value.takeError();
+  auto Policy = StringSwitch<std::optional<ExecutionPolicy>>(*Value)
+                    .Case("seq", ExecutionPolicy::Seq)
+                    .Case("par", ExecutionPolicy::Par)
+                    .Case("par_unseq", ExecutionPolicy::ParUnseq)
+                    .Case("unseq", ExecutionPolicy::Unseq)
+                    .Default(std::nullopt);
+  if (!Policy)
+    return clauseError("unknown policy '" + *Value +
+                       "', expected one of seq, par, par_unseq, unseq");
+  Opts.Policy = *Policy;
+  return Error::success();
+}
+
+static Error parseSchedule(const Clause &C, ParallelOptions &Opts) {
+  auto Value = requireValue(C);
+  if (!Value)
+    return Value.takeError();
+  auto Sched = StringSwitch<std::optional<Schedule>>(*Value)
+                   .Case("auto", Schedule::Auto)
+                   .Case("static", Schedule::Static)
+                   .Case("dynamic", Schedule::Dynamic)
+                   .Case("guided", Schedule::Guided)
+                   .Default(std::nullopt);
+  if (!Sched)
+    return clauseError("unknown schedule '" + *Value +
+                       "', expected one of auto, static, dynamic, guided");
+  Opts.Sched = *Sched;
+  return Error::success();
+}
+
+static Error parseGrain(const Clause &C, ParallelOptions &Opts) {
+  auto Value = requireValue(C);
+  if (!Value)
+    return Value.takeError();
+  unsigned Grain;
+  if (Value->getAsInteger(10, Grain) || Grain == 0)
+    return clauseError("grain must be a positive integer, got '" + *Value +
+                       "'");
+  Opts.Grain = Grain;
+  return Error::success();
+}
+
+static Error parseCollapse(const Clause &C, ParallelOptions &Opts) {
+  auto Value = requireValue(C);
+  if (!Value)
+    return Value.takeError();
+  unsigned Collapse;
+  if (Value->getAsInteger(10, Collapse) || Collapse == 0 || Collapse > 2)
+    return clauseError("collapse must be 1 or 2, got '" + *Value + "'");
+  Opts.Collapse = Collapse;
+  return Error::success();
+}
+
+static Error parseAffinity(const Clause &C, ParallelOptions &Opts) {
+  auto Value = requireValue(C);
+  if (!Value)
+    return Value.takeError();
+  auto Bind = StringSwitch<std::optional<Affinity>>(*Value)
+                  .Case("spread", Affinity::Spread)
+                  .Case("close", Affinity::Close)
+                  .Default(std::nullopt);
+  if (!Bind)
+    return clauseError("unknown affinity '" + *Value +
+                       "', expected one of spread, close");
+  Opts.Bind = *Bind;
+  return Error::success();
+}
+
+static Error parseFirstTouch(const Clause &C, ParallelOptions &Opts) {
+  if (C.Value || C.Arguments)
+    return clauseError("clause 'first_touch' takes no value");
+  Opts.FirstTouch = true;
+  return Error::success();
+}
+
+static bool isIdentifier(StringRef Name) {
+  if (Name.empty() || isDigit(Name.front()))
+    return false;
+  return all_of(Name, [](char C) { return isAlnum(C) || C == '_'; });
+}
+
+// A callable used as a combiner may be qualified, e.g. `stats::merge`.
+static bool isQualifiedName(StringRef Name) {
+  SmallVector<StringRef, 4> Parts;
+  Name.consume_front("::");
+  Name.split(Parts, "::");
+  return all_of(Parts, isIdentifier);
+}
+
+static Error parseReduce(const Clause &C, ParallelOptions &Opts) {
+  if (!C.Arguments)
+    return clauseError("clause 'reduce' expects the form "
+                       "'reduce(<op>: <variable>, ...)'");
+  auto [Op, Vars] = C.Arguments->split(':');
+  Op = Op.trim();
+  if (Op.empty() || Vars.empty())
+    return clauseError("clause 'reduce' expects the form "
+                       "'reduce(<op>: <variable>, ...)'");
+  if (Op != "+" && Op != "*" && !isQualifiedName(Op))
+    return clauseError("invalid reduction operator '" + Op +
+                       "', expected +, *, min, max or a function name");
+  SmallVector<StringRef, 4> Names;
+  Vars.split(Names, ',');
+  for (StringRef Name : Names) {
+    Name = Name.trim();
+    if (!isIdentifier(Name))
+      return clauseError("invalid reduction variable '" + Name + "'");
+    if (any_of(Opts.Reductions,
+               [&](const Reduction &R) { return R.Var == Name; }))
+      return clauseError("variable '" + Name + "' is reduced more than once");
+    Opts.Reductions.push_back({Op.str(), Name.str()});
+  }
+  return Error::success();
+}
+
+static Error parseAsync(const Clause &C, ParallelOptions &Opts) {
+  if (!C.Arguments)
+    return clauseError("clause 'async' expects the form 'async(<handle>)'");
+  if (!isIdentifier(*C.Arguments))
+    return clauseError("invalid handle name '" + *C.Arguments + "'");
+  Opts.Async = C.Arguments->str();
+  return Error::success();
+}
+
+static Error parsePrivate(const Clause &C, ParallelOptions &Opts) {
+  if (!C.Arguments || C.Arguments->empty())
+    return clauseError(
+        "clause 'private' expects the form 'private(<local>, ...)'");
+  SmallVector<StringRef, 4> Names;
+  C.Arguments->split(Names, ',');
+  for (StringRef Name : Names) {
+    Name = Name.trim();
+    if (!isIdentifier(Name))
+      return clauseError("invalid private variable '" + Name + "'");
+    if (is_contained(Opts.Privates, Name))
+      return clauseError("variable '" + Name +
+                         "' is made private more than once");
+    Opts.Privates.push_back(Name.str());
+  }
+  return Error::success();
+}
+
+// Clauses that may be given more than once, e.g. one `reduce` per operator.
+static bool isRepeatable(StringRef Name) { return Name == "reduce"; }
+
+Error parseParallelClause(StringRef Text, ParallelOptions &Opts) {
+  auto C = splitClause(Text);
+  if (!C)
+    return C.takeError();
+
+  using ClauseParser = Error (*)(const Clause &, ParallelOptions &);
+  auto Parser = StringSwitch<ClauseParser>(C->Name)
+                    .Case("policy", parsePolicy)
+                    .Case("schedule", parseSchedule)
+                    .Case("grain", parseGrain)
+                    .Case("collapse", parseCollapse)
+                    .Case("affinity", parseAffinity)
+                    .Case("first_touch", parseFirstTouch)
+                    .Case("reduce", parseReduce)
+                    .Case("async", parseAsync)
+                    .Case("private", parsePrivate)
+                    .Default(nullptr);
+  if (!Parser)
+    return clauseError("unknown clause '" + C->Name + "'");
+  if (!Opts.Explicit.insert(C->Name).second && !isRepeatable(C->Name))
+    return clauseError("duplicate clause '" + C->Name + "'");
+  return Parser(*C, Opts);
+}
+
+Error checkParallelOptions(const ParallelOptions &Opts) {
+  if (Opts.FirstTouch && Opts.Bind == Affinity::None)
+    return clauseError("clause 'first_touch' requires an 'affinity' clause");
+  if (Opts.Bind != Affinity::None &&
+      (Opts.Sched == Schedule::Dynamic || Opts.Sched == Schedule::Guided))
+    return clauseError("clause 'affinity' splits the range statically, which "
+                       "conflicts with 'schedule=" +
+                       getScheduleName(Opts.Sched) + "'");
+  return Error::success();
+}
+
+const AnnotateAttr *getParallelAnnotation(const AttributedStmt &S) {
+  for (const auto *A : S.getAttrs()) {
+    const auto *Annotate = dyn_cast<AnnotateAttr>(A);
+    if (Annotate && Annotate->getAnnotation() == "parallel")
+      return Annotate;
+  }
+  return nullptr;
+}
+
+SmallVector<const StringLiteral *, 4>
+getParallelArguments(const AnnotateAttr &Attr) {
+  SmallVector<const StringLiteral *, 4> Arguments;
+  for (const Expr *Arg : Attr.args())
+    if (const auto *Literal = dyn_cast<StringLiteral>(Arg->IgnoreParenCasts()))
+      Arguments.push_back(Literal);
+  return Arguments;
+}
+
+Expected<ParallelOptions> getParallelOptions(const AttributedStmt &S) {
+  ParallelOptions Opts;
+  const auto *Annotate = getParallelAnnotation(S);
+  if (!Annotate)
+    return Opts;
+  for (const auto *Arg : getParallelArguments(*Annotate))
+    if (auto Err = parseParallelClause(Arg->getString(), Opts))
+      return std::move(Err);
+  if (auto Err = checkParallelOptions(Opts))
+    return std::move(Err);
+  return Opts;
+}
+
+StringRef getPolicyName(ExecutionPolicy Policy) {
+  switch (Policy) {
+  case ExecutionPolicy::Seq:
+    return "seq";
+  case ExecutionPolicy::Par:
+    return "par";
+  case ExecutionPolicy::ParUnseq:
+    return "par_unseq";
+  case ExecutionPolicy::Unseq:
+    return "unseq";
+  }
+  llvm_unreachable("unknown execution policy");
+}
+
+StringRef getScheduleName(Schedule Sched) {
+  switch (Sched) {
+  case Schedule::Auto:
+    return "auto";
+  case Schedule::Static:
+    return "static";
+  case Schedule::Dynamic:
+    return "dynamic";
+  case Schedule::Guided:
+    return "guided";
+  }
+  llvm_unreachable("unknown schedule");
+}
+
+StringRef getAffinityName(Affinity Bind) {
+  switch (Bind) {
+  case Affinity::None:
+    return "none";
+  case Affinity::Spread:
+    return "spread";
+  case Affinity::Close:
+    return "close";
+  }
+  llvm_unreachable("unknown affinity");
+}
+
+} // namespace clang::parallel
@@ -0,0 +1,86 @@
+#ifndef PARALLEL_OPTIONS_H
+#define PARALLEL_OPTIONS_H
+#include "clang/AST/Attr.h"
+#include "clang/AST/Stmt.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/Error.h"
+#include <string>
+#include <vector>
+
+namespace clang::parallel {
+
+enum class ExecutionPolicy { Seq, Par, ParUnseq, Unseq };
+
+enum class Schedule { Auto, Static, Dynamic, Guided };
+
+// How the threads of a loop with an `affinity` clause are placed on the CPUs.
+// None leaves the placement to the library.
+enum class Affinity { None, Spread, Close };
+
+// One variable of a `reduce(op: var, ...)` clause. Op is one of `+`, `*`,
+// `min`, `max`, or the name of a user-supplied callable `T(T, T)` whose
+// identity is a value-initialized `T`.
+struct Reduction {
+  std::string Op;
+  std::string Var;
+
+  bool isBuiltinOp() const {
+    return Op == "+" || Op == "*" || Op == "min" || Op == "max";
+  }
+};
+
+// Arguments of a `[[parallel("key=value", ...)]]` attribute. Every argument is
+// a string literal holding exactly one clause.
+struct ParallelOptions {
+  ExecutionPolicy Policy = ExecutionPolicy::Par;
+  Schedule Sched = Schedule::Auto;
+  // Iterations processed by a single task, 0 lets the lowering decide.
+  unsigned Grain = 0;
+  // Number of perfectly nested loops flattened into one iteration space, see
+  // getCollapsedLoop.
+  unsigned Collapse = 1;
+  // Pins the threads of the loop and splits its range statically, so that
+  // every run of the loop gives a thread the same part of the range.
+  Affinity Bind = Affinity::None;
+  // Aligns the parts of the range to pages instead of cache lines, for loops
+  // that touch memory first and thereby decide on which NUMA node it lives.
+  bool FirstTouch = false;
+  std::vector<Reduction> Reductions;
+  // Locals of the body named by `private(<local>, ...)`, which every task
+  // declares once and clears for each of its iterations instead, see
+  // getPrivateLocals.
+  std::vector<std::string> Privates;
+  // Name of the std::future an `async(<handle>)` loop is launched into, empty
+  // for a loop that returns once it finished.
+  std::string Async;
+
+  // Names of the clauses that were spelled out in the attribute.
+  llvm::StringSet<> Explicit;
+  bool isExplicit(llvm::StringRef Clause) const {
+    return Explicit.contains(Clause);
+  }
+};
+
+// Parses a single clause into Opts, or explains why it is malformed.
+llvm::Error parseParallelClause(llvm::StringRef Clause, ParallelOptions &Opts);
+
+// Checks the clauses of Opts against each other, once all of them are parsed.
+llvm::Error checkParallelOptions(const ParallelOptions &Opts);
+
+// Returns the `parallel` annotation attached to S, if any.
+const AnnotateAttr *getParallelAnnotation(const AttributedStmt &S);
+
+// Returns the string literal of every argument of the annotation, in order.
+llvm::SmallVector<const StringLiteral *, 4>
+getParallelArguments(const AnnotateAttr &Attr);
+
+llvm::Expected<ParallelOptions> getParallelOptions(const AttributedStmt &S);
+
+llvm::StringRef getPolicyName(ExecutionPolicy Policy);
+llvm::StringRef getScheduleName(Schedule Sched);
+llvm::StringRef getAffinityName(Affinity Bind);
+
+} // namespace clang::parallel
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef PARALLEL_BENCH_H
+#define PARALLEL_BENCH_H
+#include <cstddef>
+
+// Every kernel of ./kernels defines these, BenchMain.cpp times them.
+//
+// The loops of a kernel carry `[[parallel(BENCH_POLICY, ...)]]`, where
+// BENCH_POLICY is the `policy=...` clause of the variant being built.
+
+// Default problem size of the kernel.
+std::size_t benchDefaultSize();
+// Allocates and initializes the data of a problem of size N.
+void benchSetup(std::size_t N);
+// The measured part, run once per repetition.
+void benchRun();
+// Digest of the result, compared between the serial and parallel builds.
+double benchChecksum();
+
+#endif
@@ -0,0 +1,67 @@
+// Times one build of a kernel and prints a JSON object to stdout:
+//
+//   {"size": 16777216, "reps": 5, "threads": 4, "time_s": [...],
+//    "median_s": 0.012, "checksum": 123.5}
+//
+// The number of threads of the parallel runtimes is taken from
+// BENCH_THREADS. OpenMP and the native runtime read their own variables
+// (OMP_NUM_THREADS, PARALLEL_RT_NUM_THREADS), which the runner sets as well;
+// TBB, used by <execution> in libstdc++, is limited here.
+#include "Bench.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#ifdef BENCH_TBB
+#include <tbb/global_control.h>
+#endif
+
+static double seconds(std::chrono::steady_clock::duration D) {
+  return std::chrono::duration<double>(D).count();
+}
+
+int main(int argc, char **argv) {
+  std::size_t Size = benchDefaultSize();
+  unsigned Reps = 5;
+  for (int I = 1; I + 1 < argc; I += 2) {
+    if (!std::strcmp(argv[I], "--size"))
+      Size = std::strtoull(argv[I + 1], nullptr, 10);
+    else if (!std::strcmp(argv[I], "--reps"))
+      Reps = std::max(1, std::atoi(argv[I + 1]));
+  }
+  unsigned Threads = 0;
+  if (const char *Env = std::getenv("BENCH_THREADS"))
+    Threads = std::atoi(Env);
+#ifdef BENCH_TBB
+  std::unique_ptr<tbb::global_control> Limit;
+  if (Threads != 0)
+    Limit = std::make_unique<tbb::global_control>(
+        tbb::global_control::max_allowed_parallelism, Threads);
+#endif
+
+  benchSetup(Size);
+  // Warm up caches and start the thread pools.
+  benchRun();
+  std::vector<double> Times;
+  for (unsigned R = 0; R != Reps; ++R) {
+    benchSetup(Size);
+    auto Start = std::chrono::steady_clock::now();
+    benchRun();
+    Times.push_back(seconds(std::chrono::steady_clock::now() - Start));
+  }
+  std::vector<double> Sorted = Times;
+  std::sort(Sorted.begin(), Sorted.end());
+
+  std::printf("{\"size\": %zu, \"reps\": %u, \"threads\": %u, \"time_s\": [",
+              Size, Reps, Threads);
+  for (std::size_t I = 0; I != Times.size(); ++I)
+    std::printf("%s%.9g", I ? ", " : "", Times[I]);
+  std::printf("], \"median_s\": %.9g, \"checksum\": %.17g}\n",
+              Sorted[Sorted.size() / 2], benchChecksum());
+  return 0;
+}
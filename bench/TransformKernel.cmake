@@ -0,0 +1,18 @@
+# Runs parallel-transformer over one kernel and writes the rewritten source.
+#
+#   cmake -DTRANSFORMER=<exe> -DBACKEND=<std|openmp|native>
+#         -DPOLICY=<policy> -DINCLUDE_DIR=<dir> -DINPUT=<src> -DOUTPUT=<dst>
+#         -P TransformKernel.cmake
+#
+# The cost model is turned off, every kernel measures the lowering itself.
+execute_process(
+  COMMAND ${TRANSFORMER} --backend=${BACKEND} --min-parallel-work=0 ${INPUT}
+          -- -std=c++17 -I${INCLUDE_DIR} "-DBENCH_POLICY=\"policy=${POLICY}\""
+  OUTPUT_FILE ${OUTPUT}.tmp
+  ERROR_VARIABLE Errors
+  RESULT_VARIABLE Result
+)
+if(NOT Result EQUAL 0)
+  message(FATAL_ERROR "parallel-transformer failed on ${INPUT}:\n${Errors}")
+endif()
+file(RENAME ${OUTPUT}.tmp ${OUTPUT})
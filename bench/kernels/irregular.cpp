@@ -0,0 +1,37 @@
+// Iterations of very different cost: the length of the Collatz sequence of
+// every seed, which needs dynamic load balancing.
+#include "Bench.h"
+#include <cstdint>
+#include <vector>
+
+struct Item {
+  std::uint64_t Seed;
+  unsigned Steps;
+};
+
+static std::vector<Item> Items;
+
+std::size_t benchDefaultSize() { return std::size_t(1) << 20; }
+
+void benchSetup(std::size_t N) {
+  Items.resize(N);
+  for (std::size_t I = 0; I != N; ++I)
+    Items[I] = {I * 7919 % (N * 8) + 1, 0};
+}
+
+void benchRun() {
+  [[parallel(BENCH_POLICY, "schedule=dynamic")]]
+  for (Item &It : Items) {
+    unsigned Steps = 0;
+    for (std::uint64_t X = It.Seed; X != 1; ++Steps)
+      X = X % 2 ? 3 * X + 1 : X / 2;
+    It.Steps = Steps;
+  }
+}
+
+double benchChecksum() {
+  double Total = 0;
+  for (const Item &It : Items)
+    Total += It.Steps;
+  return Total;
+}
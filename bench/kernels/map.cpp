@@ -0,0 +1,25 @@
+// Independent element-wise update, bound by memory bandwidth.
+#include "Bench.h"
+#include <cmath>
+#include <numeric>
+#include <vector>
+
+static std::vector<double> Data;
+
+std::size_t benchDefaultSize() { return std::size_t(1) << 24; }
+
+void benchSetup(std::size_t N) {
+  Data.resize(N);
+  std::iota(Data.begin(), Data.end(), 0.0);
+}
+
+void benchRun() {
+  [[parallel(BENCH_POLICY)]]
+  for (double &X : Data) {
+    X = std::sqrt(X) * 2.0 + 1.0;
+  }
+}
+
+double benchChecksum() {
+  return std::accumulate(Data.begin(), Data.end(), 0.0);
+}
@@ -0,0 +1,25 @@
+// Sum of squares, a single `+` reduction.
+#include "Bench.h"
+#include <vector>
+
+static std::vector<double> Data;
+static double Result;
+
+std::size_t benchDefaultSize() { return std::size_t(1) << 24; }
+
+void benchSetup(std::size_t N) {
+  Data.resize(N);
+  for (std::size_t I = 0; I != N; ++I)
+    Data[I] = static_cast<double>(I % 97) / 97.0;
+}
+
+void benchRun() {
+  double Total = 0;
+  [[parallel(BENCH_POLICY, "reduce(+: Total)")]]
+  for (double X : Data) {
+    Total += X * X;
+  }
+  Result = Total;
+}
+
+double benchChecksum() { return Result; }
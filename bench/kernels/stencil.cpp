@@ -0,0 +1,31 @@
+// Three-point stencil over a 1D grid, each output reads its neighbours.
+#include "Bench.h"
+#include <numeric>
+#include <vector>
+
+static std::vector<double> In, Out;
+static std::vector<std::size_t> Cells;
+
+std::size_t benchDefaultSize() { return std::size_t(1) << 23; }
+
+void benchSetup(std::size_t N) {
+  In.resize(N);
+  Out.assign(N, 0.0);
+  for (std::size_t I = 0; I != N; ++I)
+    In[I] = static_cast<double>(I % 1024);
+  // Interior cells only.
+  Cells.resize(N > 2 ? N - 2 : 0);
+  std::iota(Cells.begin(), Cells.end(), std::size_t(1));
+}
+
+void benchRun() {
+  for (int Step = 0; Step != 4; ++Step) {
+    [[parallel(BENCH_POLICY)]]
+    for (std::size_t I : Cells) {
+      Out[I] = (In[I - 1] + In[I] + In[I + 1]) / 3.0;
+    }
+    In.swap(Out);
+  }
+}
+
+double benchChecksum() { return std::accumulate(In.begin(), In.end(), 0.0); }
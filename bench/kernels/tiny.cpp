@@ -0,0 +1,24 @@
+// A cheap body over a few elements, run many times: measures the dispatch
+// overhead of a parallel loop, which no lowering can hide.
+#include "Bench.h"
+#include <numeric>
+#include <vector>
+
+static std::vector<int> Data;
+
+std::size_t benchDefaultSize() { return 64; }
+
+void benchSetup(std::size_t N) { Data.assign(N, 0); }
+
+void benchRun() {
+  for (int Round = 0; Round != 10000; ++Round) {
+    [[parallel(BENCH_POLICY)]]
+    for (int &X : Data) {
+      X += 1;
+    }
+  }
+}
+
+double benchChecksum() {
+  return std::accumulate(Data.begin(), Data.end(), 0.0);
+}
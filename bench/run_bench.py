@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+"""Runs the parallel-bench kernels and writes their timings as JSON.
+
+Every positional argument is `kernel:backend:policy:executable`, the serial
+build of a kernel using the backend `serial`. Parallel builds are run with 1,
+2, 4, ... threads up to the number of CPUs; speedups are relative to the
+serial build of the same kernel.
+"""
+
+import argparse
+import json
+import math
+import os
+import platform
+import subprocess
+import sys
+
+
+def thread_counts(limit):
+    counts = []
+    n = 1
+    while n < limit:
+        counts.append(n)
+        n *= 2
+    counts.append(limit)
+    return counts
+
+
+def run(executable, threads, reps):
+    env = dict(os.environ)
+    for name in ("BENCH_THREADS", "OMP_NUM_THREADS", "PARALLEL_RT_NUM_THREADS"):
+        env[name] = str(threads)
+    output = subprocess.run([executable, "--reps", str(reps)], env=env,
+                            check=True, capture_output=True, text=True).stdout
+    return json.loads(output)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--output", required=True)
+    parser.add_argument("--reps", type=int, default=5)
+    parser.add_argument("--max-threads", type=int, default=os.cpu_count())
+    parser.add_argument("runs", nargs="+")
+    args = parser.parse_args()
+
+    builds = [run_spec.split(":", 3) for run_spec in args.runs]
+    serial = {}
+    for kernel, backend, _, executable in builds:
+        if backend == "serial":
+            serial[kernel] = run(executable, 1, args.reps)
+
+    results = []
+    for kernel, backend, policy, executable in builds:
+        if backend == "serial":
+            continue
+        base = serial[kernel]
+        for threads in thread_counts(args.max_threads):
+            timing = run(executable, threads, args.reps)
+            speedup = base["median_s"] / timing["median_s"]
+            results.append({
+                "kernel": kernel,
+                "backend": backend,
+                "policy": policy,
+                "threads": threads,
+                "size": timing["size"],
+                "median_s": timing["median_s"],
+                "time_s": timing["time_s"],
+                "speedup": speedup,
+                "efficiency": speedup / threads,
+                # Reductions may be reassociated, so allow rounding.
+                "checksum_ok": math.isclose(timing["checksum"],
+                                            base["checksum"], rel_tol=1e-9),
+            })
+            print("{:<10} {:<7} {:<10} {:>3} threads  {:>10.6f}s  x{:.2f}{}"
+                  .format(kernel, backend, policy, threads,
+                          timing["median_s"], speedup,
+                          "" if results[-1]["checksum_ok"]
+                          else "  CHECKSUM MISMATCH"))
+
+    report = {
+        "host": {"machine": platform.machine(), "cpus": os.cpu_count()},
+        "serial": {kernel: timing["median_s"]
+                   for kernel, timing in serial.items()},
+        "results": results,
+    }
+    with open(args.output, "w") as out:
+        json.dump(report, out, indent=2)
+    print("wrote", args.output)
+    return 0 if all(r["checksum_ok"] for r in results) else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,31 @@
+#include <array>
+
+std::array<int, 4> merge(std::array<int, 4> a, const std::array<int, 4> &b) {
+  for (int i = 0; i < 4; i++)
+    a[i] += b[i];
+  return a;
+}
+
+void test_reduction() {
+  int arr[4096]{};
+  long sum = 0;
+  int lo = 0, hi = 0;
+  std::array<int, 4> hist{};
+  [[parallel("reduce(+: sum)")]]
+  for (auto &i : arr) {
+    sum += i;
+  }
+  [[parallel("reduce(min: lo)", "reduce(max: hi)")]]
+  for (auto &i : arr) {
+    lo = i < lo ? i : lo;
+    hi = i > hi ? i : hi;
+  }
+  [[parallel("reduce(merge: hist)")]]
+  for (auto &i : arr) {
+    hist[i & 3]++;
+  }
+  [[parallel("reduce(+: total)")]]
+  for (auto &i : arr) {
+    i = i * 2;
+  }
+}
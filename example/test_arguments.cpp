@@ -0,0 +1,11 @@
+void test_arguments() {
+  int arr[8192]{};
+  [[parallel("policy=par_unseq", "grain=4096", "schedule=dynamic")]]
+  for (auto &i : arr) {
+    i = i * 2;
+  }
+  [[parallel("policy=fast", "chunk=4")]]
+  for (auto &i : arr) {
+    i = i + 1;
+  }
+}
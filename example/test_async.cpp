@@ -0,0 +1,12 @@
+#include <future>
+
+void test_async(float (&out)[65536], float &scale) {
+  std::future<void> done;
+  [[parallel("async(done)")]]
+  for (auto &x : out) {
+    x = x * scale;
+  }
+  scale = 2;
+  float first = out[0];
+  done.wait();
+}
@@ -0,0 +1,11 @@
+void scale(double *a, const double *b, int n) {
+  [[parallel]]
+  for (int i = 0; i < n; ++i) {
+    a[i] = b[i] * 2;
+  }
+  [[parallel]]
+  for (int i = 0; i < n; ++i) {
+    if (a[i] < 0)
+      ++i;
+  }
+}
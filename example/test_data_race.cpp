@@ -0,0 +1,32 @@
+#include <atomic>
+
+void test_data_race(int *out, int n) {
+  int arr[4096]{};
+  int hist[16]{};
+  int last = 0;
+  long sum = 0;
+  std::atomic<long> count{0};
+  [[parallel]]
+  for (auto &i : arr) {
+    last = i;
+    sum += i;
+    out[0] = i;
+    hist[i % 16]++;
+    count++;
+    int local = i * 2;
+    local += 1;
+    i = local;
+  }
+}
+
+void test_element_index(int (&bins)[65536], int *(&ptrs)[65536]) {
+  int hist[16]{};
+  [[parallel]]
+  for (int b : bins) {
+    hist[b]++;
+  }
+  [[parallel]]
+  for (int *p : ptrs) {
+    *p = 0;
+  }
+}
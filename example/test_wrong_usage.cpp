@@ -1,6 +1,6 @@
 void test_wrong_usage() {
   [[parallel]]
-  for (int i = 1; i < 10; i++) {}
+  do {} while (false);
   [[parallel]]
   while (true) {}
   [[parallel]]
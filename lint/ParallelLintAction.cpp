@@ -1,19 +1,29 @@
 #include "ParallelLintAction.h"
+#include "ParallelLintChecks.h"
 
-#include "clang/AST/ASTTypeTraits.h"
-#include "clang/AST/Decl.h"
-#include "clang/AST/Expr.h"
+#include "clang/AST/ASTConsumer.h"
 #include "clang/AST/Stmt.h"
 #include "clang/AST/StmtCXX.h"
 #include "clang/ASTMatchers/ASTMatchFinder.h"
 #include "clang/ASTMatchers/ASTMatchers.h"
 #include "clang/Basic/Diagnostic.h"
+#include "clang/Basic/DiagnosticIDs.h"
+#include "clang/Basic/SourceManager.h"
 #include "clang/Frontend/CompilerInstance.h"
 #include "clang/Frontend/FrontendPluginRegistry.h"
+#include "clang/Frontend/Utils.h"
 #include "clang/Rewrite/Core/Rewriter.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Timer.h"
+#include "llvm/Support/raw_ostream.h"
 #include <cassert>
 #include <cstring>
 #include <memory>
+#include <optional>
+#include <set>
+#include <utility>
 
 using namespace clang;
 using namespace ast_matchers;
@@ -21,192 +31,384 @@ using namespace ast_matchers;
 static StatementMatcher buildForRangeMatcher() {
   return attributedStmt(
              hasParallelAttribute(
-                 cxxForRangeStmt(hasBody(compoundStmt().bind("body")),
-                                 hasLoopVariable(varDecl().bind("var")),
-                                 hasRangeInit(expr().bind("range")))
+                 stmt(anyOf(cxxForRangeStmt(
+                                hasBody(compoundStmt().bind("body")),
+                                hasLoopVariable(varDecl().bind("var")),
+                                hasRangeInit(expr().bind("range"))),
+                            forStmt(hasBody(compoundStmt().bind("body")))))
                      .bind("for")))
       .bind("attr");
 }
 
-static StatementMatcher buildForRangeBreakMatcher() {
-  return attributedStmt(hasParallelAttribute(
-      cxxForRangeStmt(
-          hasBody(compoundStmt(forEachDescendant(breakStmt().bind("break")))
-                      .bind("body")),
-          hasLoopVariable(varDecl().bind("var")),
-          hasRangeInit(expr().bind("range")))
-          .bind("for")));
-}
-
-static StatementMatcher buildForRangeContinueMatcher() {
-  return attributedStmt(hasParallelAttribute(
-      cxxForRangeStmt(hasBody(compoundStmt(forEachDescendant(
-                                               continueStmt().bind("continue")))
-                                  .bind("body")),
-                      hasLoopVariable(varDecl().bind("var")),
-                      hasRangeInit(expr().bind("range")))
-          .bind("for")));
-}
-
-static StatementMatcher buildForRangeReturnMatcher() {
-  return attributedStmt(hasParallelAttribute(
-      cxxForRangeStmt(
-          hasBody(compoundStmt(forEachDescendant(returnStmt().bind("return")))
-                      .bind("body")),
-          hasLoopVariable(varDecl().bind("var")),
-          hasRangeInit(expr().bind("range")))
-          .bind("for")));
-}
-
-static StatementMatcher buildForRangeGotoMatcher() {
-  return attributedStmt(hasParallelAttribute(
-      cxxForRangeStmt(
-          hasBody(compoundStmt(forEachDescendant(gotoStmt().bind("goto")))
-                      .bind("body")),
-          hasLoopVariable(varDecl().bind("var")),
-          hasRangeInit(expr().bind("range")))
-          .bind("for")));
-}
-
 namespace {
+// Lints every matched parallel loop with a single walk of its body, offering
+// its lowering as fix-its. When rewriting, the lowering is also applied.
 struct MatchForRangeCallBack : public MatchFinder::MatchCallback {
-  unsigned int diag_warn_for_range;
-  MatchForRangeCallBack(unsigned int DiagWarnForRange,
-                        Rewriter &RewriteForRangeWriter)
-      : diag_warn_for_range(DiagWarnForRange),
-        RewriteForRangeWriter(RewriteForRangeWriter) {}
+  MatchForRangeCallBack(ArrayRef<std::unique_ptr<parallel::LintCheck>> Checks,
+                        transformer::EditGenerator Lower,
+                        Rewriter *RewriteForRangeWriter,
+                        DiagnosticsEngine &Diag)
+      : Checks(Checks), Lower(std::move(Lower)),
+        RewriteForRangeWriter(RewriteForRangeWriter) {
+    DiagWarnNotRewritten = Diag.getCustomDiagID(
+        DiagnosticsEngine::Warning,
+        "this loop is compiled serially, it cannot be rewritten: %0");
+  }
   void run(const MatchFinder::MatchResult &Result) override {
     const auto &Nodes = Result.Nodes;
-    auto &Diag = Result.Context->getDiagnostics();
-
     const auto *attr = Nodes.getNodeAs<AttributedStmt>("attr");
-    const auto *forSt = Nodes.getNodeAs<CXXForRangeStmt>("for");
+    const auto *forSt = Nodes.getNodeAs<Stmt>("for");
     const auto *body = Nodes.getNodeAs<CompoundStmt>("body");
-    const auto *var = Nodes.getNodeAs<VarDecl>("var");
-    const auto *range = Nodes.getNodeAs<Expr>("range");
 
-    hasErrorOccurred = Diag.hasErrorOccurred();
-    Diag.Report(forSt->getBeginLoc(), diag_warn_for_range);
+    llvm::TimeRegion Region(CheckTimer);
+    ++NumLoops;
+    auto Edits = Lower(Result);
+    SmallVector<FixItHint, 4> FixIts;
+    if (Edits)
+      FixIts = getFixIts(*Edits, *Result.SourceManager);
+    parallel::lintParallelLoop(*attr, *forSt, *body, *Result.Context, Checks,
+                               FixIts);
+    if (!RewriteForRangeWriter) {
+      consumeError(Edits.takeError());
+      return;
+    }
+    auto &Diag = Result.Context->getDiagnostics();
+    if (!Edits)
+      Diag.Report(forSt->getBeginLoc(), DiagWarnNotRewritten)
+          << toString(Edits.takeError());
+    else if (!Edits->empty() && !rewrite(FixIts, *Result.SourceManager))
+      Diag.Report(forSt->getBeginLoc(), DiagWarnNotRewritten)
+          << "it is spelled in a macro";
   }
 
+  // Accumulates the time spent in the checks, when set.
+  llvm::Timer *CheckTimer = nullptr;
+  unsigned NumLoops = 0;
+
 private:
-  Rewriter RewriteForRangeWriter;
-  bool hasErrorOccurred = false;
-};
+  ArrayRef<std::unique_ptr<parallel::LintCheck>> Checks;
+  transformer::EditGenerator Lower;
+  Rewriter *RewriteForRangeWriter;
+  // Headers whose include was already offered in a file, so that two loops
+  // of a file do not include them twice.
+  std::set<std::pair<FileID, std::string>> Included;
+  unsigned DiagWarnNotRewritten;
 
-struct MatchForRangeBreakCallBack : public MatchFinder::MatchCallback {
-  unsigned int DiagErrorUnexpectedBreakStmt;
-  MatchForRangeBreakCallBack(unsigned int DiagErrorUnexpectedBreakStmt)
-      : DiagErrorUnexpectedBreakStmt(DiagErrorUnexpectedBreakStmt) {}
-  void run(const MatchFinder::MatchResult &Result) override {
-    const auto &Nodes = Result.Nodes;
-    auto &Diag = Result.Context->getDiagnostics();
-    const auto *breakSt = Nodes.getNodeAs<BreakStmt>("break");
-    if (breakSt) {
-      Diag.Report(breakSt->getBreakLoc(), DiagErrorUnexpectedBreakStmt);
+  // Includes go before the first include of the file, or at its top.
+  static SourceLocation getIncludeLoc(const SourceManager &SM, FileID File) {
+    StringRef Code = SM.getBufferData(File);
+    size_t Offset = 0;
+    for (StringRef Rest = Code; !Rest.empty();) {
+      auto [Line, Next] = Rest.split('\n');
+      if (Line.ltrim().starts_with("#include")) {
+        Offset = Line.data() - Code.data();
+        break;
+      }
+      Rest = Next;
     }
+    return SM.getLocForStartOfFile(File).getLocWithOffset(Offset);
   }
-};
 
-struct MatchForRangeContinueCallBack : public MatchFinder::MatchCallback {
-  unsigned int DiagErrorUnexpectedContinueStmt;
-  MatchForRangeContinueCallBack(unsigned int DiagErrorUnexpectedContinueStmt)
-      : DiagErrorUnexpectedContinueStmt(DiagErrorUnexpectedContinueStmt) {}
-  void run(const MatchFinder::MatchResult &Result) override {
-    const auto &Nodes = Result.Nodes;
-    auto &Diag = Result.Context->getDiagnostics();
-    const auto *continueSt = Nodes.getNodeAs<ContinueStmt>("continue");
-    if (continueSt) {
-      Diag.Report(continueSt->getContinueLoc(),
-                  DiagErrorUnexpectedContinueStmt);
+  // The edits of a lowering as fix-its, or none when the loop comes from a
+  // macro expansion, which a fix-it cannot change.
+  SmallVector<FixItHint, 4> getFixIts(ArrayRef<transformer::Edit> Edits,
+                                      const SourceManager &SM) {
+    SmallVector<FixItHint, 4> FixIts;
+    for (const auto &Edit : Edits) {
+      if (Edit.Range.getBegin().isMacroID())
+        return {};
+      if (Edit.Kind != transformer::EditKind::AddInclude) {
+        FixIts.push_back(
+            FixItHint::CreateReplacement(Edit.Range, Edit.Replacement));
+        continue;
+      }
+      FileID File = SM.getFileID(Edit.Range.getBegin());
+      std::string Directive = "#include " + Edit.Replacement;
+      if (SM.getBufferData(File).contains(Directive) ||
+          !Included.emplace(File, Edit.Replacement).second)
+        continue;
+      FixIts.push_back(FixItHint::CreateInsertion(getIncludeLoc(SM, File),
+                                                  Directive + "\n"));
     }
+    return FixIts;
   }
-};
 
-struct MatchForRangeReturnCallBack : public MatchFinder::MatchCallback {
-  unsigned int DiagErrorUnexpectedReturnStmt;
-  MatchForRangeReturnCallBack(unsigned int DiagErrorUnexpectedReturnStmt)
-      : DiagErrorUnexpectedReturnStmt(DiagErrorUnexpectedReturnStmt) {}
-  void run(const MatchFinder::MatchResult &Result) override {
-    const auto &Nodes = Result.Nodes;
-    auto &Diag = Result.Context->getDiagnostics();
-    const auto *returnSt = Nodes.getNodeAs<ReturnStmt>("return");
-    if (returnSt) {
-      Diag.Report(returnSt->getReturnLoc(), DiagErrorUnexpectedReturnStmt);
+  // Applies FixIts. A `#line` follows every edit, so that the lines after it
+  // keep their number in the diagnostics and debug info of the compile.
+  bool rewrite(ArrayRef<FixItHint> FixIts, const SourceManager &SM) {
+    if (FixIts.empty())
+      return false;
+    for (const auto &FixIt : FixIts) {
+      const CharSourceRange &Range = FixIt.RemoveRange;
+      unsigned Line = SM.getSpellingLineNumber(Range.getEnd());
+      std::string Code = FixIt.CodeToInsert;
+      if (!StringRef(Code).ends_with("\n"))
+        Code += "\n";
+      Code += "#line " + std::to_string(Line) + "\n";
+      if (RewriteForRangeWriter->ReplaceText(Range, Code))
+        return false;
     }
+    return true;
   }
 };
 
-struct MatchForRangeGotoCallBack : public MatchFinder::MatchCallback {
-  unsigned int DiagErrorUnexpectedGotoStmt;
-  MatchForRangeGotoCallBack(unsigned int DiagErrorUnexpectedGotoStmt)
-      : DiagErrorUnexpectedGotoStmt(DiagErrorUnexpectedGotoStmt) {}
-  void run(const MatchFinder::MatchResult &Result) override {
-    const auto &Nodes = Result.Nodes;
-    auto &Diag = Result.Context->getDiagnostics();
-    const auto *gotoSt = Nodes.getNodeAs<GotoStmt>("goto");
-    if (gotoSt) {
-      Diag.Report(gotoSt->getGotoLoc(), DiagErrorUnexpectedGotoStmt);
+// Runs the matcher over the translation unit and, with `-time`, reports how
+// long the plugin took on top of the compilation.
+class ParallelLintConsumer : public ASTConsumer {
+public:
+  ParallelLintConsumer(MatchFinder &Finder, MatchForRangeCallBack &Callback,
+                       bool ReportTime)
+      : Finder(Finder), Callback(Callback), ReportTime(ReportTime) {}
+
+  void HandleTranslationUnit(ASTContext &Context) override {
+    if (!ReportTime) {
+      Finder.matchAST(Context);
+      return;
+    }
+    llvm::TimerGroup Group("parallel_lint", "parallel_lint plugin");
+    llvm::Timer Total("total", "Matching and checks", Group);
+    llvm::Timer Checks("checks", "Checks of parallel loops", Group);
+    Callback.CheckTimer = &Checks;
+    {
+      llvm::TimeRegion Region(Total);
+      Finder.matchAST(Context);
     }
+    Callback.CheckTimer = nullptr;
+    llvm::errs() << "parallel_lint: " << Callback.NumLoops
+                 << " parallel loop(s) checked\n";
+    Group.print(llvm::errs());
   }
+
+private:
+  MatchFinder &Finder;
+  MatchForRangeCallBack &Callback;
+  bool ReportTime;
 };
 } // namespace
 
-void ParallelLintAction::createDiagID(DiagnosticsEngine &Diag) {
-  DiagWarnForRangeParallel = Diag.getCustomDiagID(
-      DiagnosticsEngine::Warning,
-      "this for-range will be converted to parallel version");
-  DiagErrorUnexpectedBreakStmt = Diag.getCustomDiagID(
-      DiagnosticsEngine::Error,
-      "unexpected control flow statement 'break' found in parallel for-range");
-  DiagErrorUnexpectedContinueStmt = Diag.getCustomDiagID(
-      DiagnosticsEngine::Error, "unexpected control flow statement 'continue' "
-                                "found in parallel for-range");
-  DiagErrorUnexpectedReturnStmt = Diag.getCustomDiagID(
-      DiagnosticsEngine::Error, "unexpected control flow statement 'return' "
-                                "found in parallel for-range");
-  DiagErrorUnexpectedGotoStmt = Diag.getCustomDiagID(
-      DiagnosticsEngine::Error, "unexpected control flow statement 'goto' "
-                                "found in parallel for-range");
+bool ParallelLintAction::ParseArgs(const CompilerInstance &CI,
+                                   const std::vector<std::string> &Args) {
+  auto &Diag = CI.getDiagnostics();
+  for (const auto &Arg : Args) {
+    if (Arg == "-time") {
+      ReportTime = true;
+      continue;
+    }
+    if (Arg == "-rewrite") {
+      // Loaded with -plugin, the plugin replaces the compile.
+      if (CI.getFrontendOpts().ProgramAction == frontend::PluginAction) {
+        Diag.Report(Diag.getCustomDiagID(
+            DiagnosticsEngine::Error,
+            "parallel_lint argument '-rewrite' rewrites the input of a "
+            "compile, load the plugin with -add-plugin"));
+        return false;
+      }
+      RewriteInput = true;
+      continue;
+    }
+    if (StringRef Name = Arg; Name.consume_front("-backend=")) {
+      auto Target = llvm::StringSwitch<std::optional<parallel::Backend>>(Name)
+                        .Case("std", parallel::Backend::StdExecution)
+                        .Case("openmp", parallel::Backend::OpenMP)
+                        .Case("native", parallel::Backend::Native)
+                        .Default(std::nullopt);
+      if (Target) {
+        Lowering.Target = *Target;
+        continue;
+      }
+    }
+    Diag.Report(Diag.getCustomDiagID(DiagnosticsEngine::Error,
+                                     "unknown parallel_lint argument '%0'"))
+        << Arg;
+    return false;
+  }
+  return true;
 }
 
 std::unique_ptr<ASTConsumer>
-ParallelLintAction::CreateASTConsumer(CompilerInstance &CI, StringRef InFile) {
+ParallelLintAction::createLintConsumer(CompilerInstance &CI,
+                                       Rewriter *Rewrite) {
   assert(CI.hasASTContext() && "No ASTContext??");
   RewriteForRangeWriter.setSourceMgr(CI.getSourceManager(), CI.getLangOpts());
 
   auto &Diag = CI.getASTContext().getDiagnostics();
-  createDiagID(Diag);
+  Checks = parallel::createLintChecks(Diag);
 
   ASTFinder = std::make_unique<MatchFinder>();
-  ForRangeMatchCB = std::make_unique<MatchForRangeCallBack>(
-      DiagWarnForRangeParallel, RewriteForRangeWriter);
-  BreakMatchCB = std::make_unique<MatchForRangeBreakCallBack>(
-      DiagErrorUnexpectedBreakStmt);
-  ContinueMatchCB = std::make_unique<MatchForRangeContinueCallBack>(
-      DiagErrorUnexpectedContinueStmt);
-  ReturnMatchCB = std::make_unique<MatchForRangeReturnCallBack>(
-      DiagErrorUnexpectedReturnStmt);
-  GotoMatchCB =
-      std::make_unique<MatchForRangeGotoCallBack>(DiagErrorUnexpectedGotoStmt);
+  auto Callback = std::make_unique<MatchForRangeCallBack>(
+      Checks, parallel::buildParallelLowering(Lowering), Rewrite, Diag);
+  auto Consumer = std::make_unique<ParallelLintConsumer>(*ASTFinder, *Callback,
+                                                         ReportTime);
   ASTFinder->addMatcher(
       traverse(TK_IgnoreUnlessSpelledInSource, buildForRangeMatcher()),
-      ForRangeMatchCB.get());
-  ASTFinder->addMatcher(
-      traverse(TK_IgnoreUnlessSpelledInSource, buildForRangeBreakMatcher()),
-      BreakMatchCB.get());
-  ASTFinder->addMatcher(
-      traverse(TK_IgnoreUnlessSpelledInSource, buildForRangeContinueMatcher()),
-      ContinueMatchCB.get());
-  ASTFinder->addMatcher(
-      traverse(TK_IgnoreUnlessSpelledInSource, buildForRangeReturnMatcher()),
-      ReturnMatchCB.get());
-  ASTFinder->addMatcher(
-      traverse(TK_IgnoreUnlessSpelledInSource, buildForRangeGotoMatcher()),
-      GotoMatchCB.get());
+      Callback.get());
+  ForRangeMatchCB = std::move(Callback);
+
+  return Consumer;
+}
+
+// The parse of the input in rewrite mode. It lints and lowers the parallel
+// loops, then collects the rewritten files by name.
+class ParallelLintAction::RewriteLoopsAction : public ASTFrontendAction {
+public:
+  RewriteLoopsAction(ParallelLintAction &Plugin,
+                     llvm::StringMap<std::string> &Rewritten)
+      : Plugin(Plugin), Rewritten(Rewritten) {}
+
+  std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &CI,
+                                                 StringRef) override {
+    return Plugin.createLintConsumer(CI, &Plugin.RewriteForRangeWriter);
+  }
 
-  return std::move(ASTFinder->newASTConsumer());
+  void EndSourceFileAction() override {
+    Rewriter &Rewrite = Plugin.RewriteForRangeWriter;
+    const SourceManager &SM = Rewrite.getSourceMgr();
+    for (auto I = Rewrite.buffer_begin(), E = Rewrite.buffer_end(); I != E;
+         ++I)
+      if (OptionalFileEntryRef File = SM.getFileEntryRefForID(I->first)) {
+        std::string Code;
+        llvm::raw_string_ostream OS(Code);
+        I->second.write(OS);
+        Rewritten[File->getName()] = std::move(Code);
+      }
+  }
+
+private:
+  ParallelLintAction &Plugin;
+  llvm::StringMap<std::string> &Rewritten;
+};
+
+namespace {
+// Holds the diagnostics of the rewrite parse, until it is known whether the
+// compile sees the rewritten files.
+class DeferredDiagnostics : public DiagnosticConsumer {
+public:
+  void HandleDiagnostic(DiagnosticsEngine::Level Level,
+                        const Diagnostic &Info) override {
+    DiagnosticConsumer::HandleDiagnostic(Level, Info);
+    Stored.emplace_back(Level, Info);
+  }
+
+  std::vector<StoredDiagnostic> Stored;
+};
+} // namespace
+
+// Moves Loc, from the source manager of the rewrite parse, to the same offset
+// of the same file in To. A macro location moves to its expansion. Headers
+// the compile did not enter yet are entered without an include location.
+static SourceLocation translateLoc(SourceLocation Loc,
+                                   const SourceManager &From,
+                                   SourceManager &To) {
+  if (Loc.isInvalid())
+    return Loc;
+  Loc = From.getFileLoc(Loc);
+  auto [ID, Offset] = From.getDecomposedLoc(Loc);
+  OptionalFileEntryRef File = From.getFileEntryRefForID(ID);
+  if (!File)
+    return SourceLocation();
+  FileID ToID = To.translateFile(*File);
+  if (ToID.isInvalid())
+    ToID = To.createFileID(*File, SourceLocation(),
+                           From.getFileCharacteristic(Loc));
+  return To.getLocForStartOfFile(ToID).getLocWithOffset(Offset);
+}
+
+static CharSourceRange translateRange(CharSourceRange Range,
+                                      const SourceManager &From,
+                                      SourceManager &To) {
+  Range.setBegin(translateLoc(Range.getBegin(), From, To));
+  Range.setEnd(translateLoc(Range.getEnd(), From, To));
+  return Range;
+}
+
+// Stored, recorded by the rewrite parse, with its locations in To.
+static StoredDiagnostic translateDiagnostic(const StoredDiagnostic &Stored,
+                                            SourceManager &To) {
+  if (!Stored.getLocation().hasManager())
+    return Stored;
+  const SourceManager &From = Stored.getLocation().getManager();
+  SmallVector<CharSourceRange, 4> Ranges;
+  for (const auto &Range : Stored.getRanges())
+    Ranges.push_back(translateRange(Range, From, To));
+  SmallVector<FixItHint, 4> FixIts;
+  for (FixItHint FixIt : Stored.getFixIts()) {
+    FixIt.RemoveRange = translateRange(FixIt.RemoveRange, From, To);
+    FixIt.InsertFromRange = translateRange(FixIt.InsertFromRange, From, To);
+    FixIts.push_back(std::move(FixIt));
+  }
+  return StoredDiagnostic(
+      Stored.getLevel(), Stored.getID(), Stored.getMessage(),
+      FullSourceLoc(translateLoc(Stored.getLocation(), From, To), To), Ranges,
+      FixIts);
+}
+
+bool ParallelLintAction::rewriteInput(CompilerInstance &CI) {
+  // A syntax-only parse of the same input, which neither loads the plugin
+  // again nor writes the outputs of the compile.
+  auto Invocation = std::make_shared<CompilerInvocation>(CI.getInvocation());
+  Invocation->getFrontendOpts().AddPluginActions.clear();
+  Invocation->getFrontendOpts().ProgramAction = frontend::ParseSyntaxOnly;
+  Invocation->getFrontendOpts().DisableFree = false;
+  Invocation->getDependencyOutputOpts() = DependencyOutputOptions();
+
+  CompilerInstance Nested(CI.getPCHContainerOperations());
+  Nested.setInvocation(std::move(Invocation));
+  // The IDs are shared, so that the custom diagnostics of the checks can be
+  // reported by the compile.
+  DeferredDiagnostics Deferred;
+  Nested.setDiagnostics(new DiagnosticsEngine(
+      CI.getDiagnostics().getDiagnosticIDs(), &Nested.getDiagnosticOpts(),
+      &Deferred, /*ShouldOwnClient=*/false));
+  ProcessWarningOptions(Nested.getDiagnostics(), Nested.getDiagnosticOpts(),
+                        CI.getVirtualFileSystem(), /*ReportDiags=*/false);
+  Nested.setFileManager(&CI.getFileManager());
+  if (!Nested.createTarget())
+    return false;
+
+  llvm::StringMap<std::string> Rewritten;
+  RewriteLoopsAction Action(*this, Rewritten);
+  if (!Action.BeginSourceFile(Nested, Nested.getFrontendOpts().Inputs[0]))
+    return false;
+  if (auto Err = Action.Execute())
+    consumeError(std::move(Err));
+  Action.EndSourceFile();
+  // The compile reports the errors of the original input itself, and the
+  // plugin lints it as usual.
+  if (Deferred.getNumErrors())
+    return false;
+
+  // Diagnostics of the compiler come again from the compile, only those of
+  // the checks are reported here. Their locations belong to the source
+  // manager of the rewrite parse, which the compile does not share.
+  for (const auto &Stored : Deferred.Stored)
+    if (Stored.getID() >= diag::DIAG_UPPER_LIMIT)
+      CI.getDiagnostics().Report(
+          translateDiagnostic(Stored, CI.getSourceManager()));
+
+  SourceManager &SM = CI.getSourceManager();
+  for (const auto &Entry : Rewritten) {
+    auto File = CI.getFileManager().getOptionalFileRef(Entry.getKey());
+    if (!File)
+      continue;
+    SM.overrideFileContents(*File, llvm::MemoryBuffer::getMemBufferCopy(
+                                       Entry.getValue(), Entry.getKey()));
+    // The main file was entered before the plugin runs, with the size of
+    // its original contents, so it is entered once more.
+    if (SM.getFileEntryForID(SM.getMainFileID()) == &File->getFileEntry())
+      SM.setMainFileID(SM.createFileID(*File, SourceLocation(),
+                                       SrcMgr::C_User));
+  }
+  return true;
+}
+
+std::unique_ptr<ASTConsumer>
+ParallelLintAction::CreateASTConsumer(CompilerInstance &CI, StringRef InFile) {
+  // The compile parses the rewritten files, whose loops were linted by the
+  // rewrite parse.
+  if (RewriteInput && rewriteInput(CI))
+    return std::make_unique<ASTConsumer>();
+  return createLintConsumer(CI, nullptr);
 }
 
 static FrontendPluginRegistry::Add<ParallelLintAction>
-    Y("parallel_lint", "lint for annotated parallel for-range loop");
\ No newline at end of file
+    Y("parallel_lint", "lint for annotated parallel for-range loop");
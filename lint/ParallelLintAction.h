@@ -1,5 +1,7 @@
 #ifndef TERNARY_CONVERTER_H
 #define TERNARY_CONVERTER_H
+#include "ParallelLintChecks.h"
+#include "ParallelLowering.h"
 #include "attributedStmtMatcher.h"
 #include "clang/ASTMatchers/ASTMatchFinder.h"
 #include "clang/Frontend/FrontendAction.h"
@@ -13,29 +15,35 @@ struct ParallelLintAction : public PluginASTAction {
   std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &CI,
                                                  StringRef InFile) override;
 
-  bool ParseArgs(const CompilerInstance &,
-                 const std::vector<std::string> &) override {
-    return true;
-  }
+  bool ParseArgs(const CompilerInstance &CI,
+                 const std::vector<std::string> &Args) override;
 
   ActionType getActionType() override {
     return ActionType::CmdlineAfterMainAction;
   }
 
 private:
+  class RewriteLoopsAction;
+
+  // Lints the parallel loops of the translation unit of CI, and lowers them
+  // through Rewrite when it is set.
+  std::unique_ptr<ASTConsumer> createLintConsumer(CompilerInstance &CI,
+                                                  Rewriter *Rewrite);
+  // Lints and rewrites the input of CI in a parse of its own, then hands the
+  // rewritten files to the compile in place of the original ones. Returns
+  // false, leaving the compile untouched, when the parse fails.
+  bool rewriteInput(CompilerInstance &CI);
+
   std::unique_ptr<ast_matchers::MatchFinder> ASTFinder;
   std::unique_ptr<ast_matchers::MatchFinder::MatchCallback> ForRangeMatchCB;
-  std::unique_ptr<ast_matchers::MatchFinder::MatchCallback> BreakMatchCB;
-  std::unique_ptr<ast_matchers::MatchFinder::MatchCallback> ContinueMatchCB;
-  std::unique_ptr<ast_matchers::MatchFinder::MatchCallback> ReturnMatchCB;
-  std::unique_ptr<ast_matchers::MatchFinder::MatchCallback> GotoMatchCB;
-
-  void createDiagID(DiagnosticsEngine &Diag);
-  unsigned int DiagWarnForRangeParallel;
-  unsigned int DiagErrorUnexpectedBreakStmt;
-  unsigned int DiagErrorUnexpectedContinueStmt;
-  unsigned int DiagErrorUnexpectedReturnStmt;
-  unsigned int DiagErrorUnexpectedGotoStmt;
+  std::vector<std::unique_ptr<parallel::LintCheck>> Checks;
+
+  // Set by `-plugin-arg-parallel_lint -time`.
+  bool ReportTime = false;
+  // Set by `-plugin-arg-parallel_lint -rewrite`.
+  bool RewriteInput = false;
+  // Set by `-plugin-arg-parallel_lint -backend=<name>`.
+  parallel::LoweringOptions Lowering;
 
   Rewriter RewriteForRangeWriter;
 };
@@ -0,0 +1,691 @@
+#include "ParallelLintChecks.h"
+#include "AsyncAnalysis.h"
+#include "CostModel.h"
+#include "LoopAnalysis.h"
+#include "RaceAnalysis.h"
+#include "VectorizeAnalysis.h"
+
+#include "clang/AST/Decl.h"
+#include "clang/AST/DeclCXX.h"
+#include "clang/AST/Expr.h"
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/Support/ErrorHandling.h"
+#include <optional>
+
+using namespace llvm;
+
+namespace clang::parallel {
+
+namespace {
+// Announces every parallel loop and reports malformed attribute arguments.
+class ArgumentsCheck : public LintCheck {
+public:
+  explicit ArgumentsCheck(DiagnosticsEngine &Diag) {
+    DiagWarnForRangeParallel = Diag.getCustomDiagID(
+        DiagnosticsEngine::Warning,
+        "this %select{for-range|for loop}0 will be converted to parallel "
+        "version");
+    DiagErrorInvalidArgument = Diag.getCustomDiagID(
+        DiagnosticsEngine::Error, "invalid 'parallel' argument: %0");
+  }
+
+  // Every argument is parsed on its own, so that each malformed clause is
+  // reported at its own string literal. Clauses conflicting with each other
+  // are reported at the attribute.
+  void beginLoop(const LintLoop &Loop) override {
+    Loop.Diag.Report(Loop.For.getBeginLoc(), DiagWarnForRangeParallel)
+        << isa<ForStmt>(Loop.For) << Loop.FixIts;
+    const auto *Annotate = getParallelAnnotation(Loop.Attr);
+    if (!Annotate)
+      return;
+    ParallelOptions Opts;
+    for (const auto *Arg : getParallelArguments(*Annotate))
+      if (auto Err = parseParallelClause(Arg->getString(), Opts))
+        Loop.Diag.Report(Arg->getBeginLoc(), DiagErrorInvalidArgument)
+            << toString(std::move(Err));
+    if (auto Err = checkParallelOptions(Opts))
+      Loop.Diag.Report(Annotate->getLocation(), DiagErrorInvalidArgument)
+          << toString(std::move(Err));
+  }
+
+private:
+  unsigned DiagWarnForRangeParallel;
+  unsigned DiagErrorInvalidArgument;
+};
+
+// A reduction variable has to be declared outside of the loop and used in its
+// body, otherwise the clause is most likely a typo.
+class ReductionCheck : public LintCheck {
+public:
+  explicit ReductionCheck(DiagnosticsEngine &Diag) {
+    DiagWarnUnusedReduction = Diag.getCustomDiagID(
+        DiagnosticsEngine::Warning,
+        "reduction variable '%0' is not a variable of the enclosing scope "
+        "used in this parallel for-range");
+  }
+
+  void beginLoop(const LintLoop &Loop) override {
+    Locals.clear();
+    Used.clear();
+    Locals.insert(getLoopVariable(Loop.For));
+  }
+
+  void visitDecl(const Decl &D, const LintLoop &Loop) override {
+    if (const auto *Var = dyn_cast<VarDecl>(&D))
+      Locals.insert(Var);
+  }
+
+  void visitStmt(const Stmt &S, const LintLoop &Loop) override {
+    const auto *Ref = dyn_cast<DeclRefExpr>(&S);
+    if (!Ref || Locals.contains(Ref->getDecl()))
+      return;
+    if (const auto *Var = dyn_cast<VarDecl>(Ref->getDecl()))
+      if (Var->getIdentifier())
+        Used.insert(Var->getName());
+  }
+
+  void endLoop(const LintLoop &Loop) override {
+    if (!Loop.Opts)
+      return;
+    for (const auto &R : Loop.Opts->Reductions)
+      if (!Used.contains(R.Var))
+        Loop.Diag.Report(Loop.For.getBeginLoc(), DiagWarnUnusedReduction)
+            << R.Var;
+  }
+
+private:
+  unsigned DiagWarnUnusedReduction;
+  SmallPtrSet<const Decl *, 16> Locals;
+  StringSet<> Used;
+};
+
+// A parallel `for` loop has to be a counted loop, see getCountedLoop, so that
+// its iterations can be numbered before any of them runs.
+class CountedLoopCheck : public LintCheck {
+public:
+  explicit CountedLoopCheck(DiagnosticsEngine &Diag) {
+    DiagErrorNotCounted = Diag.getCustomDiagID(
+        DiagnosticsEngine::Error,
+        "parallel for loop is not a counted loop: %0");
+  }
+
+  void beginLoop(const LintLoop &Loop) override {
+    const auto *For = dyn_cast<ForStmt>(&Loop.For);
+    if (!For)
+      return;
+    if (auto Counted = getCountedLoop(*For, Loop.Context); !Counted)
+      Loop.Diag.Report(For->getBeginLoc(), DiagErrorNotCounted)
+          << toString(Counted.takeError());
+  }
+
+private:
+  unsigned DiagErrorNotCounted;
+};
+
+// `collapse=2` needs a perfect nest whose nested loop does not depend on the
+// outer one, see getCollapsedLoop.
+class CollapseCheck : public LintCheck {
+public:
+  explicit CollapseCheck(DiagnosticsEngine &Diag) {
+    DiagErrorNotCollapsible = Diag.getCustomDiagID(
+        DiagnosticsEngine::Error, "cannot collapse the parallel loop nest: %0");
+  }
+
+  void beginLoop(const LintLoop &Loop) override {
+    if (!Loop.Opts || !Loop.Opts->isExplicit("collapse"))
+      return;
+    if (auto Nested = getCollapsedLoop(Loop.For, *Loop.Opts, Loop.Context);
+        !Nested)
+      Loop.Diag.Report(Loop.For.getBeginLoc(), DiagErrorNotCollapsible)
+          << toString(Nested.takeError());
+  }
+
+private:
+  unsigned DiagErrorNotCollapsible;
+};
+
+// Checks the locals of a `private` clause, see getPrivateLocals, and suggests
+// one for standard containers every iteration constructs, whose allocations
+// hammer the heap all threads share.
+class PrivateCheck : public LintCheck {
+public:
+  explicit PrivateCheck(DiagnosticsEngine &Diag) {
+    DiagErrorInvalidPrivate = Diag.getCustomDiagID(
+        DiagnosticsEngine::Error, "invalid 'private' clause: %0");
+    DiagWarnHoistable = Diag.getCustomDiagID(
+        DiagnosticsEngine::Warning,
+        "every iteration constructs '%0', whose allocations contend for the "
+        "heap shared by all threads; declare it once per task with "
+        "[[parallel(\"private(%0)\")]]");
+  }
+
+  void beginLoop(const LintLoop &Loop) override {
+    if (!Loop.Opts)
+      return;
+    if (auto Privates = getPrivateLocals(Loop.For, *Loop.Opts, Loop.Context);
+        !Privates) {
+      Loop.Diag.Report(Loop.For.getBeginLoc(), DiagErrorInvalidPrivate)
+          << toString(Privates.takeError());
+      return;
+    }
+    if (Loop.Opts->Policy == ExecutionPolicy::Seq)
+      return;
+    const Stmt *Innermost = &Loop.For;
+    if (auto Nested = getCollapsedLoop(Loop.For, *Loop.Opts, Loop.Context);
+        !Nested)
+      consumeError(Nested.takeError());
+    else if (*Nested)
+      Innermost = *Nested;
+    const auto *Body = dyn_cast<CompoundStmt>(getLoopBody(*Innermost));
+    if (!Body)
+      return;
+    for (const Stmt *S : Body->body()) {
+      const auto *Decls = dyn_cast<DeclStmt>(S);
+      if (!Decls || !Decls->isSingleDecl())
+        continue;
+      const auto *Var = dyn_cast<VarDecl>(Decls->getSingleDecl());
+      if (!Var || !Var->getIdentifier() || !isHeapContainer(Var->getType()) ||
+          is_contained(Loop.Opts->Privates, Var->getName()))
+        continue;
+      if (auto Err = checkPrivateLocal(*Var)) {
+        consumeError(std::move(Err));
+        continue;
+      }
+      Loop.Diag.Report(Var->getLocation(), DiagWarnHoistable)
+          << Var->getName();
+    }
+  }
+
+private:
+  unsigned DiagErrorInvalidPrivate;
+  unsigned DiagWarnHoistable;
+
+  static bool isHeapContainer(QualType Type) {
+    const auto *Record = Type->getAsCXXRecordDecl();
+    return Record && Record->isInStdNamespace() &&
+           StringSwitch<bool>(Record->getName())
+               .Cases("vector", "basic_string", "deque", "list", true)
+               .Cases("forward_list", "map", "multimap", "set", "multiset",
+                      true)
+               .Cases("unordered_map", "unordered_multimap", true)
+               .Cases("unordered_set", "unordered_multiset", true)
+               .Default(false);
+  }
+};
+
+// The body becomes a lambda called once per element, so control flow leaving
+// the loop has no meaning anymore.
+class ControlFlowCheck : public LintCheck {
+public:
+  explicit ControlFlowCheck(DiagnosticsEngine &Diag) {
+    DiagErrorUnexpectedBreakStmt = Diag.getCustomDiagID(
+        DiagnosticsEngine::Error, "unexpected control flow statement 'break' "
+                                  "found in parallel for-range");
+    DiagErrorUnexpectedContinueStmt = Diag.getCustomDiagID(
+        DiagnosticsEngine::Error, "unexpected control flow statement "
+                                  "'continue' found in parallel for-range");
+    DiagErrorUnexpectedReturnStmt = Diag.getCustomDiagID(
+        DiagnosticsEngine::Error, "unexpected control flow statement 'return' "
+                                  "found in parallel for-range");
+    DiagErrorUnexpectedGotoStmt = Diag.getCustomDiagID(
+        DiagnosticsEngine::Error, "unexpected control flow statement 'goto' "
+                                  "found in parallel for-range");
+  }
+
+  void visitStmt(const Stmt &S, const LintLoop &Loop) override {
+    if (const auto *Break = dyn_cast<BreakStmt>(&S))
+      Loop.Diag.Report(Break->getBreakLoc(), DiagErrorUnexpectedBreakStmt);
+    else if (const auto *Continue = dyn_cast<ContinueStmt>(&S))
+      Loop.Diag.Report(Continue->getContinueLoc(),
+                       DiagErrorUnexpectedContinueStmt);
+    else if (const auto *Return = dyn_cast<ReturnStmt>(&S))
+      Loop.Diag.Report(Return->getReturnLoc(), DiagErrorUnexpectedReturnStmt);
+    else if (const auto *Goto = dyn_cast<GotoStmt>(&S))
+      Loop.Diag.Report(Goto->getGotoLoc(), DiagErrorUnexpectedGotoStmt);
+  }
+
+private:
+  unsigned DiagErrorUnexpectedBreakStmt;
+  unsigned DiagErrorUnexpectedContinueStmt;
+  unsigned DiagErrorUnexpectedReturnStmt;
+  unsigned DiagErrorUnexpectedGotoStmt;
+};
+
+// Reports writes to memory shared by all iterations, see RaceAnalysis.h.
+class DataRaceCheck : public LintCheck {
+public:
+  explicit DataRaceCheck(DiagnosticsEngine &Diag) {
+    DiagErrorSharedWrite = Diag.getCustomDiagID(
+        DiagnosticsEngine::Error,
+        "data race: '%0' of the enclosing scope is %1 by every iteration of "
+        "the parallel for-range");
+    DiagErrorSharedElementWrite = Diag.getCustomDiagID(
+        DiagnosticsEngine::Error,
+        "data race: every iteration of the parallel for-range writes to the "
+        "same location, the pointer or index does not depend on the loop "
+        "variable");
+    DiagWarnUnprovenElementWrite = Diag.getCustomDiagID(
+        DiagnosticsEngine::Warning,
+        "possible data race: the pointer or index written through is computed "
+        "from the loop variable and may be the same for several iterations");
+    DiagWarnSharedMutatingCall = Diag.getCustomDiagID(
+        DiagnosticsEngine::Warning,
+        "possible data race: non-const member function '%0' is called on '%1' "
+        "by every iteration of the parallel for-range");
+    DiagNoteSuggestReduction = Diag.getCustomDiagID(
+        DiagnosticsEngine::Note,
+        "accumulate with [[parallel(\"reduce(%0: %1)\")]] or make '%1' a "
+        "std::atomic");
+    DiagNoteSuggestAtomic = Diag.getCustomDiagID(
+        DiagnosticsEngine::Note,
+        "make '%0' a std::atomic or protect it with a std::mutex");
+    DiagNoteOnlyAppend = Diag.getCustomDiagID(
+        DiagnosticsEngine::Note,
+        "appends to '%0' are kept in order when the body uses '%0' for "
+        "nothing else");
+  }
+
+  // Malformed arguments are reported by ArgumentsCheck.
+  void beginLoop(const LintLoop &Loop) override {
+    Tracker.reset();
+    if (Loop.Opts)
+      Tracker.emplace(Loop.For, *Loop.Opts);
+  }
+
+  void visitDecl(const Decl &D, const LintLoop &Loop) override {
+    if (Tracker)
+      Tracker->observe(D);
+  }
+
+  void visitStmt(const Stmt &S, const LintLoop &Loop) override {
+    if (Tracker)
+      Tracker->observe(S);
+  }
+
+  void endLoop(const LintLoop &Loop) override {
+    if (!Tracker)
+      return;
+    for (const auto &Finding : Tracker->takeFindings())
+      report(Loop.Diag, Finding);
+    Tracker.reset();
+  }
+
+private:
+  unsigned DiagErrorSharedWrite;
+  unsigned DiagErrorSharedElementWrite;
+  unsigned DiagWarnUnprovenElementWrite;
+  unsigned DiagWarnSharedMutatingCall;
+  unsigned DiagNoteSuggestReduction;
+  unsigned DiagNoteSuggestAtomic;
+  unsigned DiagNoteOnlyAppend;
+  std::optional<DataRaceTracker> Tracker;
+
+  void report(DiagnosticsEngine &Diag, const RaceFinding &Finding) {
+    SourceLocation Loc = Finding.Access->getExprLoc();
+    std::string Target =
+        Finding.Target ? Finding.Target->getNameAsString() : "this";
+    switch (Finding.Kind) {
+    case RaceFinding::SharedWrite:
+      Diag.Report(Loc, DiagErrorSharedWrite) << Target << "written";
+      break;
+    case RaceFinding::SharedUpdate:
+      Diag.Report(Loc, DiagErrorSharedWrite) << Target << "updated";
+      if (!Finding.SuggestedOp.empty())
+        Diag.Report(Loc, DiagNoteSuggestReduction)
+            << Finding.SuggestedOp << Target;
+      else
+        Diag.Report(Loc, DiagNoteSuggestAtomic) << Target;
+      break;
+    case RaceFinding::SharedElementWrite:
+      Diag.Report(Loc, DiagErrorSharedElementWrite);
+      break;
+    case RaceFinding::UnprovenElementWrite:
+      Diag.Report(Loc, DiagWarnUnprovenElementWrite);
+      break;
+    case RaceFinding::SharedMutatingCall:
+      Diag.Report(Loc, DiagWarnSharedMutatingCall)
+          << Finding.Method->getNameAsString() << Target;
+      if (AppendTracker::getAppendTarget(*Finding.Access))
+        Diag.Report(Loc, DiagNoteOnlyAppend) << Target;
+      break;
+    }
+  }
+};
+
+// The code between an `async(<handle>)` loop and the wait for its handle runs
+// alongside the loop, so it must not touch what the loop writes, nor write
+// what the loop reads, see findAsyncConflicts.
+class AsyncCheck : public LintCheck {
+public:
+  explicit AsyncCheck(DiagnosticsEngine &Diag) {
+    DiagErrorHandle = Diag.getCustomDiagID(
+        DiagnosticsEngine::Error, "asynchronous parallel loop: %0");
+    DiagErrorUsesWritten = Diag.getCustomDiagID(
+        DiagnosticsEngine::Error,
+        "data race: '%0' is written by the asynchronous parallel loop and used "
+        "before '%1' is waited for");
+    DiagErrorWritesRead = Diag.getCustomDiagID(
+        DiagnosticsEngine::Error,
+        "data race: '%0' is used by the asynchronous parallel loop and written "
+        "before '%1' is waited for");
+    DiagErrorOutlivedBy = Diag.getCustomDiagID(
+        DiagnosticsEngine::Error,
+        "'%0' is destroyed before '%1' is waited for, while the asynchronous "
+        "parallel loop may still use it");
+    DiagNoteLoop = Diag.getCustomDiagID(DiagnosticsEngine::Note,
+                                        "asynchronous parallel loop is here");
+  }
+
+  void beginLoop(const LintLoop &Loop) override {
+    Footprint.reset();
+    if (Loop.Opts && !Loop.Opts->Async.empty())
+      Footprint.emplace(Loop.For);
+  }
+
+  void visitDecl(const Decl &D, const LintLoop &Loop) override {
+    if (Footprint)
+      Footprint->observe(D);
+  }
+
+  void visitStmt(const Stmt &S, const LintLoop &Loop) override {
+    if (Footprint)
+      Footprint->observe(S);
+  }
+
+  void endLoop(const LintLoop &Loop) override {
+    if (!Footprint)
+      return;
+    StringRef Name = Loop.Opts->Async;
+    auto Handle = findAsyncHandle(Loop.Attr, Name, Loop.Context);
+    if (!Handle) {
+      Loop.Diag.Report(Loop.For.getBeginLoc(), DiagErrorHandle)
+          << toString(Handle.takeError());
+      return;
+    }
+    for (const AsyncConflict &Conflict :
+         findAsyncConflicts(Loop.Attr, *Footprint, **Handle, Loop.Context)) {
+      std::string Var = Conflict.Var->getNameAsString();
+      switch (Conflict.Kind) {
+      case AsyncConflict::UsesWritten:
+        Loop.Diag.Report(Conflict.Access->getExprLoc(), DiagErrorUsesWritten)
+            << Var << Name;
+        break;
+      case AsyncConflict::WritesRead:
+        Loop.Diag.Report(Conflict.Access->getExprLoc(), DiagErrorWritesRead)
+            << Var << Name;
+        break;
+      case AsyncConflict::OutlivedBy:
+        Loop.Diag.Report(Conflict.Var->getLocation(), DiagErrorOutlivedBy)
+            << Var << Name;
+        break;
+      }
+      Loop.Diag.Report(Loop.For.getBeginLoc(), DiagNoteLoop);
+    }
+    Footprint.reset();
+  }
+
+private:
+  unsigned DiagErrorHandle;
+  unsigned DiagErrorUsesWritten;
+  unsigned DiagErrorWritesRead;
+  unsigned DiagErrorOutlivedBy;
+  unsigned DiagNoteLoop;
+  std::optional<LoopFootprint> Footprint;
+};
+
+// Parallel execution only pays off once a loop does enough work to hide the
+// cost of dispatching it, see CostModel.h.
+class CostCheck : public LintCheck {
+public:
+  explicit CostCheck(DiagnosticsEngine &Diag) {
+    DiagWarnTooCheap = Diag.getCustomDiagID(
+        DiagnosticsEngine::Warning,
+        "parallel for-range runs %0 iterations of about %1 operations each, "
+        "too little work to benefit from parallel execution");
+    DiagNoteConstructedSize = Diag.getCustomDiagID(
+        DiagnosticsEngine::Note,
+        "assuming '%0' still holds the %1 elements it is constructed with");
+  }
+
+  void beginLoop(const LintLoop &Loop) override {
+    Estimator = CostEstimator();
+    Trip = getTripCount(Loop.For, Loop.Context);
+    Nested = nullptr;
+    if (!Trip || !Loop.Opts)
+      return;
+    // A collapsed nest runs the body of its nested loop once per iteration of
+    // both loops.
+    auto Collapsed = getCollapsedLoop(Loop.For, *Loop.Opts, Loop.Context);
+    if (!Collapsed) {
+      consumeError(Collapsed.takeError());
+      return;
+    }
+    Nested = *Collapsed;
+    if (!Nested)
+      return;
+    auto NestedTrip = getTripCount(*Nested, Loop.Context);
+    if (Trip->Exact && NestedTrip && NestedTrip->Exact)
+      Trip->Count *= NestedTrip->Count;
+    else
+      Trip.reset();
+  }
+
+  void visitStmt(const Stmt &S, const LintLoop &Loop) override {
+    if (Trip)
+      Estimator.observe(S);
+  }
+
+  void endLoop(const LintLoop &Loop) override {
+    // A sequential policy already asks for no parallelism.
+    if (!Trip || !Loop.Opts || Loop.Opts->Policy == ExecutionPolicy::Seq)
+      return;
+    std::uint64_t Cost = Nested ? estimateIterationCost(*getLoopBody(*Nested))
+                                : Estimator.getCost();
+    if (!isTooCheap(Trip->Count, Cost, DefaultMinParallelWork))
+      return;
+    Loop.Diag.Report(Loop.For.getBeginLoc(), DiagWarnTooCheap)
+        << std::to_string(Trip->Count) << std::to_string(Cost);
+    if (!Trip->Exact)
+      Loop.Diag.Report(Trip->Container->getLocation(), DiagNoteConstructedSize)
+          << Trip->Container->getName() << std::to_string(Trip->Count);
+  }
+
+private:
+  unsigned DiagWarnTooCheap;
+  unsigned DiagNoteConstructedSize;
+  std::optional<TripCount> Trip;
+  const Stmt *Nested = nullptr;
+  CostEstimator Estimator;
+};
+
+// Ranges of forward iterators are split by bucket or by gathering the
+// addresses of their elements, see classifyRange. Any other range is walked
+// by every task to find its share of the elements.
+class RangeStrategyCheck : public LintCheck {
+public:
+  explicit RangeStrategyCheck(DiagnosticsEngine &Diag) {
+    DiagWarnSequentialRange = Diag.getCustomDiagID(
+        DiagnosticsEngine::Warning,
+        "the iterators of '%0' are not forward iterators: every task walks "
+        "the range to find its elements, which may be slower than the serial "
+        "loop");
+  }
+
+  void beginLoop(const LintLoop &Loop) override {
+    const auto *For = dyn_cast<CXXForRangeStmt>(&Loop.For);
+    if (!For || !Loop.Opts || Loop.Opts->Policy == ExecutionPolicy::Seq ||
+        Loop.Opts->Collapse > 1)
+      return;
+    if (classifyRange(*For, Loop.Context) != RangeKind::Sequential)
+      return;
+    const Expr *Range = For->getRangeInit();
+    Loop.Diag.Report(Range->getExprLoc(), DiagWarnSequentialRange)
+        << Range->getType().getAsString();
+  }
+
+private:
+  unsigned DiagWarnSequentialRange;
+};
+
+// Explains why a loop without a `policy` clause is not made unsequenced, and
+// warns when an unsequenced policy is asked for a body that is not safe to
+// interleave. Only the first blocker of a loop is reported.
+class VectorizeCheck : public LintCheck {
+public:
+  explicit VectorizeCheck(DiagnosticsEngine &Diag) {
+    DiagRemarkKeepsPolicy = Diag.getCustomDiagID(
+        DiagnosticsEngine::Remark,
+        "parallel for-range keeps policy 'par' instead of 'par_unseq': %0");
+    DiagWarnUnsafePolicy = Diag.getCustomDiagID(
+        DiagnosticsEngine::Warning,
+        "policy '%0' interleaves iterations on one thread, but %1");
+  }
+
+  void beginLoop(const LintLoop &Loop) override {
+    Checker.reset();
+    if (!Loop.Opts)
+      return;
+    bool Explicit = Loop.Opts->isExplicit("policy");
+    bool Unsequenced = Loop.Opts->Policy == ExecutionPolicy::ParUnseq ||
+                       Loop.Opts->Policy == ExecutionPolicy::Unseq;
+    if (!Explicit || Unsequenced)
+      Checker.emplace(Loop.For, *Loop.Opts);
+  }
+
+  void visitDecl(const Decl &D, const LintLoop &Loop) override {
+    if (Checker)
+      Checker->observe(D);
+  }
+
+  void visitStmt(const Stmt &S, const LintLoop &Loop) override {
+    if (Checker)
+      Checker->observe(S);
+  }
+
+  void endLoop(const LintLoop &Loop) override {
+    if (!Checker)
+      return;
+    auto Blockers = Checker->takeBlockers();
+    Checker.reset();
+    if (Blockers.empty())
+      return;
+    const VectorizeBlocker &First = Blockers.front();
+    if (Loop.Opts->isExplicit("policy"))
+      Loop.Diag.Report(First.Loc, DiagWarnUnsafePolicy)
+          << getPolicyName(Loop.Opts->Policy) << describe(First);
+    else
+      Loop.Diag.Report(First.Loc, DiagRemarkKeepsPolicy) << describe(First);
+  }
+
+private:
+  unsigned DiagRemarkKeepsPolicy;
+  unsigned DiagWarnUnsafePolicy;
+  std::optional<VectorizeChecker> Checker;
+
+  static std::string describe(const VectorizeBlocker &Blocker) {
+    std::string Name =
+        Blocker.Decl ? "'" + Blocker.Decl->getNameAsString() + "'" : "";
+    switch (Blocker.Kind) {
+    case VectorizeBlocker::OpaqueCall:
+      if (!Blocker.Decl)
+        return "the body makes an indirect call";
+      if (const auto *Method = dyn_cast<CXXMethodDecl>(Blocker.Decl))
+        if (Method->isVirtual())
+          return "the body calls " + Name + ", which is virtual";
+      if (cast<FunctionDecl>(Blocker.Decl)->getBuiltinID())
+        return "the body calls " + Name + ", which is a library function";
+      if (cast<FunctionDecl>(Blocker.Decl)->isInlined())
+        return "the body calls " + Name +
+               ", which may allocate, synchronize or call code that is not "
+               "inline";
+      return "the body calls " + Name + ", which is not inline";
+    case VectorizeBlocker::Synchronization:
+      return "the body synchronizes through " + Name;
+    case VectorizeBlocker::Allocation:
+      if (!Blocker.Decl)
+        return "the body allocates memory";
+      if (isa<FunctionDecl>(Blocker.Decl))
+        return "the body calls " + Name + ", which allocates memory";
+      return "the body constructs " + Name +
+             ", whose type has a non-trivial destructor";
+    case VectorizeBlocker::Exception:
+      return "the body throws or catches exceptions";
+    case VectorizeBlocker::InlineAsm:
+      return "the body contains inline assembly";
+    case VectorizeBlocker::Dependence:
+      if (!Blocker.Decl)
+        return "iterations may write to the same location";
+      return "iterations depend on each other through " + Name;
+    case VectorizeBlocker::Append:
+      return "the body appends to " + Name +
+             ", which keeps the order of the iterations";
+    }
+    llvm_unreachable("unknown vectorization blocker");
+  }
+};
+
+class LoopBodyWalker : public RecursiveASTVisitor<LoopBodyWalker> {
+public:
+  LoopBodyWalker(const LintLoop &Loop,
+                 ArrayRef<std::unique_ptr<LintCheck>> Checks)
+      : Loop(Loop), Checks(Checks) {}
+
+  bool VisitDecl(Decl *D) {
+    for (const auto &Check : Checks)
+      Check->visitDecl(*D, Loop);
+    return true;
+  }
+
+  bool VisitStmt(Stmt *S) {
+    for (const auto &Check : Checks)
+      Check->visitStmt(*S, Loop);
+    return true;
+  }
+
+private:
+  const LintLoop &Loop;
+  ArrayRef<std::unique_ptr<LintCheck>> Checks;
+};
+} // namespace
+
+std::vector<std::unique_ptr<LintCheck>>
+createLintChecks(DiagnosticsEngine &Diag) {
+  std::vector<std::unique_ptr<LintCheck>> Checks;
+  Checks.push_back(std::make_unique<ArgumentsCheck>(Diag));
+  Checks.push_back(std::make_unique<CountedLoopCheck>(Diag));
+  Checks.push_back(std::make_unique<CollapseCheck>(Diag));
+  Checks.push_back(std::make_unique<PrivateCheck>(Diag));
+  Checks.push_back(std::make_unique<ReductionCheck>(Diag));
+  Checks.push_back(std::make_unique<ControlFlowCheck>(Diag));
+  Checks.push_back(std::make_unique<DataRaceCheck>(Diag));
+  Checks.push_back(std::make_unique<AsyncCheck>(Diag));
+  Checks.push_back(std::make_unique<CostCheck>(Diag));
+  Checks.push_back(std::make_unique<RangeStrategyCheck>(Diag));
+  Checks.push_back(std::make_unique<VectorizeCheck>(Diag));
+  return Checks;
+}
+
+void lintParallelLoop(const AttributedStmt &Attr, const Stmt &For,
+                      const CompoundStmt &Body, ASTContext &Context,
+                      ArrayRef<std::unique_ptr<LintCheck>> Checks,
+                      ArrayRef<FixItHint> FixIts) {
+  std::optional<ParallelOptions> Opts;
+  if (auto Parsed = getParallelOptions(Attr))
+    Opts = std::move(*Parsed);
+  else
+    consumeError(Parsed.takeError());
+
+  LintLoop Loop{Attr,    For,  Body, Opts ? &*Opts : nullptr,
+                Context, Context.getDiagnostics(), FixIts};
+  for (const auto &Check : Checks)
+    Check->beginLoop(Loop);
+  LoopBodyWalker Walker(Loop, Checks);
+  Walker.TraverseStmt(const_cast<CompoundStmt *>(&Body));
+  for (const auto &Check : Checks)
+    Check->endLoop(Loop);
+}
+
+} // namespace clang::parallel
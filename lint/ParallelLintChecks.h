@@ -0,0 +1,53 @@
+#ifndef PARALLEL_LINT_CHECKS_H
+#define PARALLEL_LINT_CHECKS_H
+#include "ParallelOptions.h"
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Stmt.h"
+#include "clang/AST/StmtCXX.h"
+#include "clang/Basic/Diagnostic.h"
+#include "llvm/ADT/ArrayRef.h"
+#include <memory>
+#include <vector>
+
+namespace clang::parallel {
+
+// The `[[parallel]]` loop being linted.
+struct LintLoop {
+  const AttributedStmt &Attr;
+  // The for-range loop, or the `for` loop.
+  const Stmt &For;
+  const CompoundStmt &Body;
+  // Null when the arguments of the attribute are malformed.
+  const ParallelOptions *Opts;
+  ASTContext &Context;
+  DiagnosticsEngine &Diag;
+  // Replace the loop with its parallel version, attached to the warning
+  // announcing it. Empty when the loop cannot be lowered.
+  llvm::ArrayRef<FixItHint> FixIts;
+};
+
+// A check of the lint plugin. The body of every parallel loop is walked once,
+// handing each declaration and statement to all checks in pre-order, so a
+// check never walks the body on its own.
+class LintCheck {
+public:
+  virtual ~LintCheck() = default;
+  virtual void beginLoop(const LintLoop &Loop) {}
+  virtual void visitDecl(const Decl &D, const LintLoop &Loop) {}
+  virtual void visitStmt(const Stmt &S, const LintLoop &Loop) {}
+  virtual void endLoop(const LintLoop &Loop) {}
+};
+
+// Creates every check of the plugin, registering its diagnostics with Diag.
+std::vector<std::unique_ptr<LintCheck>>
+createLintChecks(DiagnosticsEngine &Diag);
+
+// Runs Checks over one parallel loop with a single walk of its body.
+void lintParallelLoop(const AttributedStmt &Attr, const Stmt &For,
+                      const CompoundStmt &Body, ASTContext &Context,
+                      llvm::ArrayRef<std::unique_ptr<LintCheck>> Checks,
+                      llvm::ArrayRef<FixItHint> FixIts = {});
+
+} // namespace clang::parallel
+
+#endif
@@ -0,0 +1,310 @@
+#ifndef PARALLEL_PROBE_H
+#define PARALLEL_PROBE_H
+// Header-only probes inserted by `parallel-transformer --instrument` around
+// every parallel region it emits.
+//
+// A region is a `[[parallel]]` loop, keyed by the file and line of the loop.
+// Each execution of the region counts one call and its wall time. Each task
+// the region is split into counts its elements and the time it kept its
+// thread busy. When a task cannot know its elements, as for the threads of an
+// OpenMP loop, the call counts them instead. Task counters live in per-thread
+// records that only their thread writes, so probes on different threads never
+// share a cache line.
+//
+// The counters of every region are written once, when the program exits.
+// PARALLEL_PROBE_OUTPUT names the file to write: a name ending in `.json`
+// gets JSON, any other name CSV. Without it, CSV goes to stderr. Regions
+// never executed are left out.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace parallel_probe {
+namespace detail {
+
+inline std::uint64_t now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Adds to a counter only written by one thread, without a locked operation.
+inline void bump(std::atomic<std::uint64_t> &Counter, std::uint64_t Value) {
+  Counter.store(Counter.load(std::memory_order_relaxed) + Value,
+                std::memory_order_relaxed);
+}
+
+struct RegionData {
+  const char *File;
+  unsigned Line;
+  std::atomic<std::uint64_t> Calls{0};
+  std::atomic<std::uint64_t> Elements{0};
+  std::atomic<std::uint64_t> WallNs{0};
+};
+
+// Counters of the tasks one thread ran for one region.
+struct alignas(64) ThreadData {
+  std::size_t Region;
+  std::size_t Thread;
+  std::atomic<std::uint64_t> Tasks{0};
+  std::atomic<std::uint64_t> Elements{0};
+  std::atomic<std::uint64_t> BusyNs{0};
+};
+
+// Owns every record, so that counters outlive the regions and threads they
+// belong to, and writes them out from its destructor at exit.
+class Registry {
+public:
+  static Registry &instance() {
+    static Registry R;
+    return R;
+  }
+
+  std::size_t addRegion(const char *File, unsigned Line) {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    RegionData &R = Regions.emplace_back();
+    R.File = File;
+    R.Line = Line;
+    return Regions.size() - 1;
+  }
+
+  RegionData &region(std::size_t Id) {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    return Regions[Id];
+  }
+
+  ThreadData &addThread(std::size_t Region, std::size_t Thread) {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    ThreadData &T = Threads.emplace_back();
+    T.Region = Region;
+    T.Thread = Thread;
+    return T;
+  }
+
+  std::size_t nextThread() {
+    return NumThreads.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Counters of one source location, summed over the regions spelled there:
+  // a loop in a template or an inline function gets one region per copy.
+  struct Summary {
+    std::string File;
+    unsigned Line = 0;
+    std::uint64_t Calls = 0, WallNs = 0, Tasks = 0, Elements = 0, BusyNs = 0;
+    std::map<std::size_t, std::uint64_t> BusyPerThread;
+
+    std::uint64_t maxBusyNs() const {
+      std::uint64_t Max = 0;
+      for (const auto &[Thread, Ns] : BusyPerThread)
+        Max = std::max(Max, Ns);
+      return Max;
+    }
+  };
+
+  std::vector<Summary> summarize() {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    std::map<std::pair<std::string, unsigned>, Summary> ByLocation;
+    auto Get = [&](const RegionData &R) -> Summary & {
+      Summary &S = ByLocation[{R.File, R.Line}];
+      S.File = R.File;
+      S.Line = R.Line;
+      return S;
+    };
+    for (const RegionData &R : Regions) {
+      Summary &S = Get(R);
+      S.Calls += R.Calls.load(std::memory_order_relaxed);
+      S.Elements += R.Elements.load(std::memory_order_relaxed);
+      S.WallNs += R.WallNs.load(std::memory_order_relaxed);
+    }
+    for (const ThreadData &T : Threads) {
+      Summary &S = Get(Regions[T.Region]);
+      S.Tasks += T.Tasks.load(std::memory_order_relaxed);
+      S.Elements += T.Elements.load(std::memory_order_relaxed);
+      std::uint64_t Busy = T.BusyNs.load(std::memory_order_relaxed);
+      S.BusyNs += Busy;
+      S.BusyPerThread[T.Thread] += Busy;
+    }
+    std::vector<Summary> Result;
+    for (auto &[Location, S] : ByLocation)
+      if (S.Calls != 0)
+        Result.push_back(std::move(S));
+    return Result;
+  }
+
+  // One line per region: file, line, calls, elements, tasks, wall time and
+  // busy time summed over all threads, threads that ran a task, and busy
+  // time of the busiest of them. Times are in nanoseconds.
+  void writeCSV(std::FILE *Out) {
+    std::fprintf(Out, "file,line,calls,elements,tasks,wall_ns,busy_ns,"
+                      "workers,max_worker_busy_ns\n");
+    for (const Summary &S : summarize()) {
+      std::fputc('"', Out);
+      for (char C : S.File) {
+        if (C == '"')
+          std::fputc('"', Out);
+        std::fputc(C, Out);
+      }
+      std::fprintf(Out, "\",%u,%llu,%llu,%llu,%llu,%llu,%zu,%llu\n", S.Line,
+                   ull(S.Calls), ull(S.Elements), ull(S.Tasks), ull(S.WallNs),
+                   ull(S.BusyNs), S.BusyPerThread.size(), ull(S.maxBusyNs()));
+    }
+  }
+
+  // The fields of writeCSV, as an array of objects.
+  void writeJSON(std::FILE *Out) {
+    std::fprintf(Out, "[");
+    const char *Separator = "\n";
+    for (const Summary &S : summarize()) {
+      std::fprintf(Out, "%s  {\"file\": \"", Separator);
+      for (char C : S.File) {
+        if (C == '"' || C == '\\')
+          std::fputc('\\', Out);
+        std::fputc(C, Out);
+      }
+      std::fprintf(Out,
+                   "\", \"line\": %u, \"calls\": %llu, \"elements\": %llu, "
+                   "\"tasks\": %llu, \"wall_ns\": %llu, \"busy_ns\": %llu, "
+                   "\"workers\": %zu, \"max_worker_busy_ns\": %llu}",
+                   S.Line, ull(S.Calls), ull(S.Elements), ull(S.Tasks),
+                   ull(S.WallNs), ull(S.BusyNs), S.BusyPerThread.size(),
+                   ull(S.maxBusyNs()));
+      Separator = ",\n";
+    }
+    std::fprintf(Out, "\n]\n");
+  }
+
+  Registry(const Registry &) = delete;
+  Registry &operator=(const Registry &) = delete;
+
+private:
+  Registry() = default;
+
+  ~Registry() {
+    const char *Path = std::getenv("PARALLEL_PROBE_OUTPUT");
+    if (!Path || !*Path) {
+      writeCSV(stderr);
+      return;
+    }
+    std::FILE *Out = std::fopen(Path, "w");
+    if (!Out) {
+      std::fprintf(stderr, "parallel_probe: cannot write '%s'\n", Path);
+      return;
+    }
+    std::size_t Length = std::strlen(Path);
+    if (Length >= 5 && std::strcmp(Path + Length - 5, ".json") == 0)
+      writeJSON(Out);
+    else
+      writeCSV(Out);
+    std::fclose(Out);
+  }
+
+  static unsigned long long ull(std::uint64_t Value) { return Value; }
+
+  std::mutex Mutex;
+  // Deques never move their elements, which other threads keep referring to.
+  std::deque<RegionData> Regions;
+  std::deque<ThreadData> Threads;
+  std::atomic<std::size_t> NumThreads{0};
+};
+
+// Records of the calling thread, indexed by region.
+class ThreadRecords {
+public:
+  ThreadData &get(std::size_t Region) {
+    if (Region >= Records.size())
+      Records.resize(Region + 1, nullptr);
+    if (!Records[Region])
+      Records[Region] = &Registry::instance().addThread(Region, Thread);
+    return *Records[Region];
+  }
+
+  static ThreadRecords &current() {
+    static thread_local ThreadRecords R;
+    return R;
+  }
+
+private:
+  std::size_t Thread = Registry::instance().nextThread();
+  std::vector<ThreadData *> Records;
+};
+
+} // namespace detail
+
+// One `[[parallel]]` loop, declared as a static local next to it.
+class Region {
+public:
+  Region(const char *File, unsigned Line)
+      : Id(detail::Registry::instance().addRegion(File, Line)),
+        Data(&detail::Registry::instance().region(Id)) {}
+
+  Region(const Region &) = delete;
+  Region &operator=(const Region &) = delete;
+
+private:
+  friend class Call;
+  friend class Task;
+
+  std::size_t Id;
+  detail::RegionData *Data;
+};
+
+// One execution of a region, from its construction to its destruction.
+class Call {
+public:
+  explicit Call(Region &R) : R(R), Start(detail::now()) {}
+  ~Call() {
+    R.Data->Calls.fetch_add(1, std::memory_order_relaxed);
+    R.Data->WallNs.fetch_add(detail::now() - Start,
+                             std::memory_order_relaxed);
+  }
+
+  // Counts Elements iterations not counted by the tasks of the call.
+  void add(std::size_t Elements) {
+    R.Data->Elements.fetch_add(Elements, std::memory_order_relaxed);
+  }
+
+  Call(const Call &) = delete;
+  Call &operator=(const Call &) = delete;
+
+private:
+  Region &R;
+  std::uint64_t Start;
+};
+
+// One task of a region running Elements iterations on the calling thread.
+class Task {
+public:
+  Task(Region &R, std::size_t Elements)
+      : Record(detail::ThreadRecords::current().get(R.Id)),
+        Elements(Elements), Start(detail::now()) {}
+  ~Task() {
+    detail::bump(Record.Tasks, 1);
+    detail::bump(Record.Elements, Elements);
+    detail::bump(Record.BusyNs, detail::now() - Start);
+  }
+
+  Task(const Task &) = delete;
+  Task &operator=(const Task &) = delete;
+
+private:
+  detail::ThreadData &Record;
+  std::size_t Elements;
+  std::uint64_t Start;
+};
+
+} // namespace parallel_probe
+
+#endif
@@ -0,0 +1,552 @@
+#ifndef PARALLEL_RT_H
+#define PARALLEL_RT_H
+// Header-only fork-join runtime targeted by `parallel-transformer
+// --backend=native`.
+//
+// A fixed pool of worker threads is started on first use and reused by every
+// call. Each worker owns a Chase-Lev deque: it pushes and pops tasks at the
+// bottom, idle workers steal from the top. Ranges are split lazily: a worker
+// only halves the range it is running while its own deque is empty, that is
+// when thieves took everything it offered, so a loop is split into about as
+// many tasks as there are idle workers and no more.
+//
+// A thread waiting for its tasks runs other tasks meanwhile, so a parallel
+// loop nested in another one neither deadlocks nor leaves threads idle. A
+// thread outside the pool takes part as well, so the pool only starts one
+// worker less than the number of threads it should use.
+//
+// The number of threads defaults to std::thread::hardware_concurrency() and
+// can be set with the PARALLEL_RT_NUM_THREADS environment variable.
+//
+// Loops with an `affinity` clause run on a separate team of as many threads,
+// each pinned to one CPU, without stealing: the calls of pinned_for are dealt
+// out to the workers round robin, so every run of a loop gives each worker
+// the same part of the range, and the pages it touched first stay on its NUMA
+// node. Pinning is only implemented on Linux.
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace parallel_rt {
+
+// Placement of the workers of pinned_for on the CPUs the process may run on:
+// `spread` distributes them evenly, `close` packs them onto neighboring CPUs.
+// Both differ only when there are fewer workers than CPUs.
+enum class affinity { spread, close };
+
+namespace detail {
+
+// Threads a parallel loop runs on, see PARALLEL_RT_NUM_THREADS.
+inline unsigned configuredThreads() {
+  static const unsigned N = [] {
+    unsigned N = std::max(1u, std::thread::hardware_concurrency());
+    if (const char *Env = std::getenv("PARALLEL_RT_NUM_THREADS"))
+      if (int Value = std::atoi(Env); Value > 0)
+        N = static_cast<unsigned>(Value);
+    return N;
+  }();
+  return N;
+}
+
+// Tasks spawned by one call, which waits until all of them finished.
+struct Group {
+  std::atomic<std::size_t> Pending{0};
+  std::atomic<bool> Failed{false};
+  std::mutex ErrorMutex;
+  std::exception_ptr Error;
+
+  void fail(std::exception_ptr E) {
+    std::lock_guard<std::mutex> Lock(ErrorMutex);
+    if (!Error)
+      Error = std::move(E);
+    Failed.store(true, std::memory_order_relaxed);
+  }
+};
+
+struct Task {
+  void (*Run)(Task *);
+  Group *Owner;
+};
+
+// Work-stealing deque of Chase and Lev, with the memory orderings of Le et
+// al., "Correct and Efficient Work-Stealing for Weak Memory Models".
+class Deque {
+public:
+  Deque() : Buffer(new Array(64)) {}
+  Deque(const Deque &) = delete;
+  Deque &operator=(const Deque &) = delete;
+  ~Deque() { delete Buffer.load(std::memory_order_relaxed); }
+
+  // Owner only.
+  void push(Task *T) {
+    std::int64_t B = Bottom.load(std::memory_order_relaxed);
+    std::int64_t Tp = Top.load(std::memory_order_acquire);
+    Array *A = Buffer.load(std::memory_order_relaxed);
+    if (B - Tp > A->Capacity - 1)
+      A = grow(A, Tp, B);
+    A->put(B, T);
+    std::atomic_thread_fence(std::memory_order_release);
+    Bottom.store(B + 1, std::memory_order_relaxed);
+  }
+
+  // Owner only.
+  Task *pop() {
+    std::int64_t B = Bottom.load(std::memory_order_relaxed) - 1;
+    Array *A = Buffer.load(std::memory_order_relaxed);
+    Bottom.store(B, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::int64_t Tp = Top.load(std::memory_order_relaxed);
+    if (Tp > B) {
+      Bottom.store(B + 1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    Task *T = A->get(B);
+    if (Tp == B) {
+      // Last task, race the thieves for it.
+      if (!Top.compare_exchange_strong(Tp, Tp + 1, std::memory_order_seq_cst,
+                                       std::memory_order_relaxed))
+        T = nullptr;
+      Bottom.store(B + 1, std::memory_order_relaxed);
+    }
+    return T;
+  }
+
+  // Any thread.
+  Task *steal() {
+    std::int64_t Tp = Top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::int64_t B = Bottom.load(std::memory_order_acquire);
+    if (Tp >= B)
+      return nullptr;
+    Task *T = Buffer.load(std::memory_order_acquire)->get(Tp);
+    if (!Top.compare_exchange_strong(Tp, Tp + 1, std::memory_order_seq_cst,
+                                     std::memory_order_relaxed))
+      return nullptr;
+    return T;
+  }
+
+  bool empty() const {
+    return Bottom.load(std::memory_order_relaxed) <=
+           Top.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct Array {
+    explicit Array(std::int64_t Capacity)
+        : Capacity(Capacity), Slots(new std::atomic<Task *>[Capacity]) {}
+
+    // Relaxed would do given the fences, but acquire and release cost
+    // nothing on common targets and make the handover visible to TSan.
+    Task *get(std::int64_t I) const {
+      return Slots[I & (Capacity - 1)].load(std::memory_order_acquire);
+    }
+    void put(std::int64_t I, Task *T) {
+      Slots[I & (Capacity - 1)].store(T, std::memory_order_release);
+    }
+
+    std::int64_t Capacity;
+    std::unique_ptr<std::atomic<Task *>[]> Slots;
+  };
+
+  // A thief may still read the old array, so it is kept until the deque
+  // goes away.
+  Array *grow(Array *Old, std::int64_t Tp, std::int64_t B) {
+    Array *New = new Array(Old->Capacity * 2);
+    for (std::int64_t I = Tp; I != B; ++I)
+      New->put(I, Old->get(I));
+    Retired.emplace_back(Old);
+    Buffer.store(New, std::memory_order_release);
+    return New;
+  }
+
+  std::atomic<std::int64_t> Top{0};
+  std::atomic<std::int64_t> Bottom{0};
+  std::atomic<Array *> Buffer;
+  std::vector<std::unique_ptr<Array>> Retired;
+};
+
+class Pool {
+public:
+  static Pool &instance() {
+    static Pool P;
+    return P;
+  }
+
+  // Threads running a parallel loop, the calling thread included.
+  unsigned threads() const {
+    return static_cast<unsigned>(Workers.size()) + 1;
+  }
+
+  void spawn(Task *T) {
+    T->Owner->Pending.fetch_add(1, std::memory_order_relaxed);
+    if (Worker *W = current()) {
+      W->Tasks.push(T);
+    } else {
+      std::lock_guard<std::mutex> Lock(InjectMutex);
+      Injected.push_back(T);
+      NumInjected.fetch_add(1, std::memory_order_relaxed);
+    }
+    notify();
+  }
+
+  // Whether the running task should offer half of its range to thieves:
+  // nothing it offered before is left.
+  bool shouldSplit() const {
+    if (Worker *W = current())
+      return W->Tasks.empty();
+    return NumInjected.load(std::memory_order_relaxed) == 0;
+  }
+
+  // Runs tasks until every task of G finished.
+  void wait(Group &G) {
+    Worker *W = current();
+    while (G.Pending.load(std::memory_order_acquire) != 0) {
+      if (Task *T = findTask(W))
+        T->Run(T);
+      else
+        std::this_thread::yield();
+    }
+  }
+
+private:
+  struct Worker {
+    Deque Tasks;
+    unsigned Index;
+  };
+
+  static Worker *&current() {
+    static thread_local Worker *W = nullptr;
+    return W;
+  }
+
+  Pool() {
+    unsigned N = configuredThreads();
+    for (unsigned I = 0; I + 1 < N; ++I) {
+      Workers.push_back(std::make_unique<Worker>());
+      Workers.back()->Index = I;
+    }
+    for (auto &W : Workers)
+      Threads.emplace_back([this, Ptr = W.get()] { run(Ptr); });
+  }
+
+  ~Pool() {
+    {
+      std::lock_guard<std::mutex> Lock(SleepMutex);
+      Stop.store(true);
+    }
+    Wake.notify_all();
+    for (auto &T : Threads)
+      T.join();
+  }
+
+  void notify() {
+    Epoch.fetch_add(1, std::memory_order_seq_cst);
+    if (Sleeping.load(std::memory_order_seq_cst) != 0) {
+      std::lock_guard<std::mutex> Lock(SleepMutex);
+      Wake.notify_all();
+    }
+  }
+
+  Task *findTask(Worker *Self) {
+    if (Self)
+      if (Task *T = Self->Tasks.pop())
+        return T;
+    if (NumInjected.load(std::memory_order_relaxed) != 0) {
+      std::lock_guard<std::mutex> Lock(InjectMutex);
+      if (!Injected.empty()) {
+        Task *T = Injected.front();
+        Injected.pop_front();
+        NumInjected.fetch_sub(1, std::memory_order_relaxed);
+        return T;
+      }
+    }
+    // Start at a different victim on every thread to spread the thieves.
+    std::size_t N = Workers.size();
+    std::size_t Start = Self ? Self->Index + 1 : 0;
+    for (std::size_t I = 0; I != N; ++I) {
+      Worker *Victim = Workers[(Start + I) % N].get();
+      if (Victim == Self)
+        continue;
+      if (Task *T = Victim->Tasks.steal())
+        return T;
+    }
+    return nullptr;
+  }
+
+  void run(Worker *Self) {
+    current() = Self;
+    unsigned Idle = 0;
+    while (true) {
+      std::uint64_t Seen = Epoch.load(std::memory_order_seq_cst);
+      if (Task *T = findTask(Self)) {
+        T->Run(T);
+        Idle = 0;
+        continue;
+      }
+      if (++Idle < 64) {
+        std::this_thread::yield();
+        continue;
+      }
+      // A spawn after Seen was read bumps the epoch, and notify() sees this
+      // thread sleeping unless the wait below sees the new epoch.
+      std::unique_lock<std::mutex> Lock(SleepMutex);
+      Sleeping.fetch_add(1, std::memory_order_seq_cst);
+      Wake.wait(Lock, [&] {
+        return Stop.load() || Epoch.load(std::memory_order_seq_cst) != Seen;
+      });
+      Sleeping.fetch_sub(1, std::memory_order_seq_cst);
+      if (Stop.load())
+        return;
+      Idle = 0;
+    }
+  }
+
+  std::vector<std::unique_ptr<Worker>> Workers;
+  std::vector<std::thread> Threads;
+
+  std::mutex InjectMutex;
+  std::deque<Task *> Injected;
+  std::atomic<std::size_t> NumInjected{0};
+
+  std::atomic<std::uint64_t> Epoch{0};
+  std::atomic<unsigned> Sleeping{0};
+  std::mutex SleepMutex;
+  std::condition_variable Wake;
+  std::atomic<bool> Stop{false};
+};
+
+// Runs Fn over [Lo, Hi), handing the upper half to thieves whenever the
+// thread has nothing left to be stolen.
+template <class Body> struct RangeTask : Task {
+  std::size_t Lo, Hi;
+  Body *Fn;
+
+  RangeTask(Group &G, std::size_t Lo, std::size_t Hi, Body &Fn)
+      : Task{&RangeTask::execute, &G}, Lo(Lo), Hi(Hi), Fn(&Fn) {}
+
+  static void runRange(Group &G, std::size_t Lo, std::size_t Hi, Body &Fn) {
+    Pool &P = Pool::instance();
+    try {
+      while (Lo < Hi && !G.Failed.load(std::memory_order_relaxed)) {
+        if (Hi - Lo > 1 && P.shouldSplit()) {
+          std::size_t Mid = Lo + (Hi - Lo) / 2;
+          P.spawn(new RangeTask(G, Mid, Hi, Fn));
+          Hi = Mid;
+          continue;
+        }
+        Fn(Lo++);
+      }
+    } catch (...) {
+      G.fail(std::current_exception());
+    }
+  }
+
+  static void execute(Task *T) {
+    auto *R = static_cast<RangeTask *>(T);
+    Group &G = *R->Owner;
+    runRange(G, R->Lo, R->Hi, *R->Fn);
+    delete R;
+    G.Pending.fetch_sub(1, std::memory_order_release);
+  }
+};
+
+// Workers pinned to one CPU each, see pinned_for. The calling thread only
+// waits, it may run anywhere.
+class Team {
+public:
+  static Team &instance(affinity Where) {
+    static Team Spread(affinity::spread);
+    static Team Close(affinity::close);
+    return Where == affinity::spread ? Spread : Close;
+  }
+
+  // Whether the current thread is a worker of a team.
+  static bool inside() { return current(); }
+
+  // Calls Fn(I) for every I in [0, N) on worker I % size.
+  template <class Body> void run(std::size_t N, Body &Fn) {
+    std::lock_guard<std::mutex> Serial(RunMutex);
+    Group G;
+    std::unique_lock<std::mutex> Lock(Mutex);
+    Job = {N, &call<Body>, &Fn, &G};
+    Running = static_cast<unsigned>(Threads.size());
+    ++Generation;
+    Start.notify_all();
+    Done.wait(Lock, [&] { return Running == 0; });
+    Lock.unlock();
+    if (G.Error)
+      std::rethrow_exception(G.Error);
+  }
+
+private:
+  struct Call {
+    std::size_t N;
+    void (*Run)(void *, std::size_t);
+    void *Fn;
+    Group *Owner;
+  };
+
+  template <class Body> static void call(void *Fn, std::size_t I) {
+    (*static_cast<Body *>(Fn))(I);
+  }
+
+  static bool &current() {
+    static thread_local bool Worker = false;
+    return Worker;
+  }
+
+  explicit Team(affinity Where) {
+    unsigned N = configuredThreads();
+    std::vector<int> CPUs = allowedCPUs();
+    for (unsigned I = 0; I != N; ++I) {
+      int CPU = -1;
+      if (!CPUs.empty()) {
+        std::size_t P = CPUs.size();
+        std::size_t Slot = Where == affinity::spread && N < P
+                               ? std::size_t(I) * P / N
+                               : std::size_t(I) % P;
+        CPU = CPUs[Slot];
+      }
+      Threads.emplace_back([this, I, N, CPU] { work(I, N, CPU); });
+    }
+  }
+
+  ~Team() {
+    {
+      std::lock_guard<std::mutex> Lock(Mutex);
+      Stop = true;
+    }
+    Start.notify_all();
+    for (auto &T : Threads)
+      T.join();
+  }
+
+  static std::vector<int> allowedCPUs() {
+    std::vector<int> CPUs;
+#if defined(__linux__)
+    cpu_set_t Set;
+    CPU_ZERO(&Set);
+    if (sched_getaffinity(0, sizeof(Set), &Set) == 0)
+      for (int CPU = 0; CPU != CPU_SETSIZE; ++CPU)
+        if (CPU_ISSET(CPU, &Set))
+          CPUs.push_back(CPU);
+#endif
+    return CPUs;
+  }
+
+  static void pin(int CPU) {
+#if defined(__linux__)
+    if (CPU < 0)
+      return;
+    cpu_set_t Set;
+    CPU_ZERO(&Set);
+    CPU_SET(CPU, &Set);
+    pthread_setaffinity_np(pthread_self(), sizeof(Set), &Set);
+#else
+    (void)CPU;
+#endif
+  }
+
+  void work(unsigned Index, unsigned Size, int CPU) {
+    pin(CPU);
+    current() = true;
+    std::uint64_t Seen = 0;
+    std::unique_lock<std::mutex> Lock(Mutex);
+    while (true) {
+      Start.wait(Lock, [&] { return Stop || Generation != Seen; });
+      if (Stop)
+        return;
+      Seen = Generation;
+      Call C = Job;
+      Lock.unlock();
+      try {
+        for (std::size_t I = Index;
+             I < C.N && !C.Owner->Failed.load(std::memory_order_relaxed);
+             I += Size)
+          C.Run(C.Fn, I);
+      } catch (...) {
+        C.Owner->fail(std::current_exception());
+      }
+      Lock.lock();
+      if (--Running == 0)
+        Done.notify_one();
+    }
+  }
+
+  std::vector<std::thread> Threads;
+  std::mutex RunMutex;
+  std::mutex Mutex;
+  std::condition_variable Start;
+  std::condition_variable Done;
+  Call Job{};
+  std::uint64_t Generation = 0;
+  unsigned Running = 0;
+  bool Stop = false;
+};
+
+} // namespace detail
+
+// Threads a parallel loop runs on, the calling thread included.
+inline unsigned num_threads() { return detail::configuredThreads(); }
+
+// Calls Fn(I) for every I in [0, N), in parallel. Returns once every call
+// returned; the first exception thrown by Fn is rethrown, and the calls not
+// started yet are skipped.
+template <class Body> void parallel_for(std::size_t N, Body &&Fn) {
+  if (N == 0)
+    return;
+  detail::Pool &P = detail::Pool::instance();
+  if (N == 1 || P.threads() == 1) {
+    for (std::size_t I = 0; I != N; ++I)
+      Fn(I);
+    return;
+  }
+  using BodyT = std::remove_reference_t<Body>;
+  detail::Group G;
+  detail::RangeTask<BodyT>::runRange(G, 0, N, Fn);
+  P.wait(G);
+  if (G.Error)
+    std::rethrow_exception(G.Error);
+}
+
+// Calls Fn(I) for every I in [0, N) on the team of pinned workers of Where,
+// worker I % num_threads() making the calls for I in increasing order.
+// Returns once every call returned; the first exception thrown by Fn is
+// rethrown. A call from a pinned worker runs serially on it.
+template <class Body>
+void pinned_for(affinity Where, std::size_t N, Body &&Fn) {
+  if (N == 0)
+    return;
+  if (detail::Team::inside()) {
+    for (std::size_t I = 0; I != N; ++I)
+      Fn(I);
+    return;
+  }
+  detail::Team::instance(Where).run(N, Fn);
+}
+
+// Calls Fn(I) for every I in [0, N) in order on the calling thread, for loops
+// asking for `policy=seq`.
+template <class Body> void serial_for(std::size_t N, Body &&Fn) {
+  for (std::size_t I = 0; I != N; ++I)
+    Fn(I);
+}
+
+} // namespace parallel_rt
+
+#endif
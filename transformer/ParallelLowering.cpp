@@ -0,0 +1,1207 @@
+#include "ParallelLowering.h"
+#include "CostModel.h"
+#include "FusionAnalysis.h"
+#include "LoopAnalysis.h"
+#include "ParallelOptions.h"
+#include "RaceAnalysis.h"
+#include "VectorizeAnalysis.h"
+#include "attributedStmtMatcher.h"
+
+#include "clang/AST/ParentMapContext.h"
+#include "clang/AST/StmtCXX.h"
+#include "clang/ASTMatchers/ASTMatchFinder.h"
+#include "clang/Basic/SourceManager.h"
+#include "clang/Tooling/Transformer/RangeSelector.h"
+#include "clang/Tooling/Transformer/SourceCode.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/raw_ostream.h"
+#include <initializer_list>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+using namespace clang;
+using namespace ast_matchers;
+using namespace clang::parallel;
+using transformer::Edit;
+using transformer::EditGenerator;
+using transformer::EditKind;
+using transformer::node;
+
+namespace {
+// Source text of the pieces of a matched loop that every lowering reuses.
+struct LoopSource {
+  // Loop variable declaration, without the trailing colon.
+  std::string Var;
+  std::string Range;
+  std::string Body;
+  // Set for a counted `for` loop, whose Var is its index, and Range empty.
+  std::optional<CountedLoop> Counted;
+  // How the range is split, see emitLoopSpace. A counted loop and the loops
+  // of a collapsed nest index their iterations directly.
+  RangeKind Kind = RangeKind::RandomAccess;
+  // The range is a standard container reached through std::data.
+  bool Data = false;
+  std::string Begin;
+  std::string End;
+  // Indentation of the line holding the attribute.
+  std::string Indent;
+  // The for-range or `for` loop the text comes from.
+  const Stmt *Loop = nullptr;
+  // Appended to the names declared for the loop, which tells the loops of a
+  // collapsed nest apart.
+  std::string Suffix;
+  // The loop collapsed with this one, see getCollapsedLoop. Its body is run
+  // instead of Body.
+  std::unique_ptr<LoopSource> Inner;
+  // Declarations of the private locals hoisted out of the body that runs,
+  // see hoistPrivates.
+  std::vector<std::string> PrivateDecls;
+
+  std::string name(StringRef Base) const { return (Base + Suffix).str(); }
+
+  // Element of iteration Counter, bound to Var, see emitIterationSpace.
+  std::string element(StringRef Counter) const {
+    if (!Counted) {
+      std::string Element = name("_par_first") + "[" + Counter.str() + "]";
+      return Kind == RangeKind::Gathered ? "*" + Element : Element;
+    }
+    std::int64_t Step = Counted->Step;
+    std::string Offset = Counter.str();
+    if (Step != 1 && Step != -1)
+      Offset += " * " + std::to_string(Step < 0 ? -Step : Step);
+    return "static_cast<" + name("_par_index_t") + ">(" + name("_par_begin") +
+           (Step < 0 ? " - " : " + ") + Offset + ")";
+  }
+
+  // Size of an element, which blocks are rounded to. The arrays a counted
+  // loop indexes are not known, their elements are assumed to be as large as
+  // the index.
+  std::string elementSize() const {
+    if (Inner)
+      return Inner->elementSize();
+    return Counted ? "sizeof(" + name("_par_index_t") + ")"
+                   : "sizeof(*" + name("_par_first") + ")";
+  }
+};
+
+// Replacement text for one loop and the standard headers it relies on.
+struct Lowering {
+  std::string Text;
+  SmallVector<StringRef, 8> Headers;
+
+  void require(std::initializer_list<StringRef> Names) {
+    for (StringRef Name : Names)
+      if (!is_contained(Headers, Name))
+        Headers.push_back(Name);
+  }
+};
+} // namespace
+
+StatementMatcher clang::parallel::buildParallelForMatcher() {
+  return attributedStmt(
+             hasParallelAttribute(
+                 stmt(anyOf(cxxForRangeStmt(
+                                hasBody(compoundStmt().bind("body")),
+                                hasLoopVariable(varDecl().bind("var")),
+                                hasRangeInit(expr().bind("range"))),
+                            forStmt(hasBody(compoundStmt().bind("body")))))
+                     .bind("for")))
+      .bind("attr");
+}
+
+static Expected<std::string> selectText(transformer::RangeSelector Selector,
+                                        const MatchFinder::MatchResult &Result) {
+  auto Range = Selector(Result);
+  if (!Range)
+    return Range.takeError();
+  return tooling::getText(*Range, *Result.Context).str();
+}
+
+// Collects the header and the body of Loop. The index of a counted loop
+// becomes `_par_index_t i`.
+static Error collectLoopHeader(LoopSource &Src, const Stmt &Loop,
+                               ASTContext &Ctx) {
+  if (const auto *For = dyn_cast<ForStmt>(&Loop)) {
+    auto Counted = getCountedLoop(*For, Ctx);
+    if (!Counted)
+      return Counted.takeError();
+    Src.Var = Src.name("_par_index_t") + " " + Counted->Index->getName().str();
+    Src.Begin = tooling::getText(*Counted->Begin, Ctx).str();
+    Src.End = tooling::getText(*Counted->End, Ctx).str();
+    Src.Counted = *Counted;
+  } else {
+    // The loop variable ends at the colon, which is not valid in a lambda
+    // parameter.
+    const auto &Range = cast<CXXForRangeStmt>(Loop);
+    Src.Var = tooling::getText(CharSourceRange::getCharRange(
+                                   Range.getLoopVariable()->getBeginLoc(),
+                                   Range.getColonLoc()),
+                               Ctx)
+                  .rtrim()
+                  .str();
+    Src.Range = tooling::getText(*Range.getRangeInit(), Ctx).str();
+  }
+  Src.Body = tooling::getText(*getLoopBody(Loop), Ctx).str();
+  Src.Loop = &Loop;
+  return Error::success();
+}
+
+// Moves the declarations of the private locals out of the body that runs for
+// every iteration into Src.PrivateDecls, leaving a call to their `clear()`
+// member function in their place, see getPrivateLocals.
+static Error hoistPrivates(LoopSource &Src, const ParallelOptions &Opts,
+                           ASTContext &Ctx) {
+  auto Privates = getPrivateLocals(*Src.Loop, Opts, Ctx);
+  if (!Privates)
+    return Privates.takeError();
+  LoopSource &Runs = Src.Inner ? *Src.Inner : Src;
+  const SourceManager &SM = Ctx.getSourceManager();
+  unsigned Start = SM.getFileOffset(getLoopBody(*Runs.Loop)->getBeginLoc());
+  // Replace from the back, so that the offsets of the others stay valid.
+  llvm::sort(*Privates, [&](const PrivateLocal &A, const PrivateLocal &B) {
+    return SM.isBeforeInTranslationUnit(B.Decl->getBeginLoc(),
+                                        A.Decl->getBeginLoc());
+  });
+  for (const PrivateLocal &Local : *Privates) {
+    unsigned Begin = SM.getFileOffset(Local.Decl->getBeginLoc()) - Start;
+    unsigned End = SM.getFileOffset(Local.Decl->getEndLoc()) + 1 - Start;
+    Src.PrivateDecls.insert(Src.PrivateDecls.begin(),
+                            Runs.Body.substr(Begin, End - Begin));
+    Runs.Body.replace(Begin, End - Begin,
+                      Local.Var->getName().str() + ".clear();");
+  }
+  return Error::success();
+}
+
+// Collects the matched loop and the loop collapsed with it, if any.
+static Expected<LoopSource>
+collectLoopSource(const MatchFinder::MatchResult &Result,
+                  const ParallelOptions &Opts) {
+  const auto *For = Result.Nodes.getNodeAs<Stmt>("for");
+  auto Inner = getCollapsedLoop(*For, Opts, *Result.Context);
+  if (!Inner)
+    return Inner.takeError();
+
+  const auto *Attr = Result.Nodes.getNodeAs<AttributedStmt>("attr");
+  unsigned Column =
+      Result.SourceManager->getSpellingColumnNumber(Attr->getBeginLoc());
+  LoopSource Src;
+  Src.Indent.assign(Column > 0 ? Column - 1 : 0, ' ');
+  if (*Inner) {
+    Src.Suffix = "0";
+    Src.Inner = std::make_unique<LoopSource>();
+    Src.Inner->Indent = Src.Indent;
+    Src.Inner->Suffix = "1";
+    if (auto Err = collectLoopHeader(*Src.Inner, **Inner, *Result.Context))
+      return std::move(Err);
+  }
+  if (auto Err = collectLoopHeader(Src, *For, *Result.Context))
+    return std::move(Err);
+  if (auto Err = hoistPrivates(Src, Opts, *Result.Context))
+    return std::move(Err);
+  return Src;
+}
+
+// Whether the iterations of a range of Kind are found by their index, see
+// emitLoopSpace.
+static bool isIndexed(RangeKind Kind) {
+  return isRandomAccess(Kind) || Kind == RangeKind::Gathered;
+}
+
+static std::string policyExpr(const ParallelOptions &Opts) {
+  return ("std::execution::" + getPolicyName(Opts.Policy)).str();
+}
+
+// Whether a loop over a sequential range is split into explicit blocks of
+// iterations instead of leaving the granularity to the library. Private
+// locals are declared once per block.
+static bool needsChunking(const ParallelOptions &Opts) {
+  return Opts.Grain != 0 || Opts.Sched == Schedule::Static ||
+         !Opts.Reductions.empty() || !Opts.Privates.empty();
+}
+
+// Name of the probe of the region the lowering is part of, see
+// wrapInstrumented.
+static constexpr StringRef ProbeRegion = "_par_region";
+// Name of the probe of the current execution of the region.
+static constexpr StringRef ProbeCall = "_par_call";
+
+// Declares the probe timing the task running Elements iterations on the
+// current thread, until the end of the enclosing scope.
+static void emitTaskProbe(raw_ostream &OS, StringRef Indent,
+                          StringRef Elements) {
+  OS << Indent << "parallel_probe::Task _par_task(" << ProbeRegion << ", "
+     << Elements << ");\n";
+}
+
+// std::for_each(par, std::begin(r), std::end(r), [&](auto &i){ ... });
+//
+// Not instrumented: a probe per element would cost more than most bodies, so
+// instrumented loops are split into blocks instead.
+static Lowering lowerForEach(const LoopSource &Src,
+                             const ParallelOptions &Opts) {
+  Lowering L;
+  L.require({"algorithm", "execution"});
+  raw_string_ostream OS(L.Text);
+  OS << "std::for_each(" << policyExpr(Opts) << ", std::begin(" << Src.Range
+     << "), std::end(" << Src.Range << "), [&](" << Src.Var << ")"
+     << Src.Body << ");";
+  return L;
+}
+
+// Declares the number of iterations of Src alone, of type CountType, and what
+// Src.element() needs to find the element of an iteration.
+//
+// A range is evaluated once into `_par_range`. Standard contiguous containers
+// are indexed through a raw pointer. The elements of a gathered range are
+// indexed through the vector of their addresses, `_par_ptrs`, filled by a
+// single walk. A hashed range counts its buckets instead of its elements. A
+// counted loop evaluates its bounds once, converted to the type of its index,
+// and counts the iterations in std::size_t so that a signed index cannot
+// overflow.
+static void emitLoopSpace(raw_ostream &OS, Lowering &L, const LoopSource &Src,
+                          StringRef CountType) {
+  StringRef I = Src.Indent;
+  std::string Count = Src.name("_par_n");
+  if (!Src.Counted) {
+    std::string Range = Src.name("_par_range");
+    std::string First = Src.name("_par_first");
+    L.require({"iterator"});
+    OS << I << "  auto &&" << Range << " = " << Src.Range << ";\n";
+    switch (Src.Kind) {
+    case RangeKind::Hashed:
+      OS << I << "  const " << CountType << " " << Count << " = " << Range
+         << ".bucket_count();\n";
+      return;
+    case RangeKind::Gathered: {
+      std::string Ptrs = Src.name("_par_ptrs");
+      L.require({"memory", "vector"});
+      OS << I << "  std::vector<decltype(std::addressof(*std::begin(" << Range
+         << ")))> " << Ptrs << ";\n";
+      OS << I << "  for (auto &_par_e : " << Range << ")\n";
+      OS << I << "    " << Ptrs << ".push_back(std::addressof(_par_e));\n";
+      OS << I << "  const auto " << First << " = " << Ptrs << ".data();\n";
+      OS << I << "  const " << CountType << " " << Count << " = " << Ptrs
+         << ".size();\n";
+      return;
+    }
+    case RangeKind::Sequential:
+      OS << I << "  auto " << First << " = std::begin(" << Range << ");\n";
+      OS << I << "  const " << CountType << " " << Count
+         << " = std::distance(" << First << ", std::end(" << Range << "));\n";
+      return;
+    case RangeKind::Contiguous:
+    case RangeKind::RandomAccess:
+      break;
+    }
+    if (Src.Data) {
+      OS << I << "  const auto " << First << " = std::data(" << Range
+         << ");\n";
+      OS << I << "  const " << CountType << " " << Count << " = std::size("
+         << Range << ");\n";
+      return;
+    }
+    OS << I << "  auto " << First << " = std::begin(" << Range << ");\n";
+    OS << I << "  const " << CountType << " " << Count << " = std::end("
+       << Range << ") - " << First << ";\n";
+    return;
+  }
+
+  const CountedLoop &Loop = *Src.Counted;
+  std::string Index = Src.name("_par_index_t");
+  std::string Begin = Src.name("_par_begin");
+  std::string End = Src.name("_par_end");
+  L.require({"cstddef"});
+  OS << I << "  using " << Index << " = "
+     << Loop.Index->getType().getUnqualifiedType().getAsString(
+            Loop.Index->getASTContext().getPrintingPolicy())
+     << ";\n";
+  OS << I << "  const " << Index << " " << Begin << " = " << Src.Begin
+     << ";\n";
+  OS << I << "  const " << Index << " " << End << " = " << Src.End << ";\n";
+  bool Down = Loop.Step < 0;
+  StringRef Low = Down ? End : Begin;
+  StringRef High = Down ? Begin : End;
+  std::string Distance = ("static_cast<std::size_t>(" + High +
+                          ") - static_cast<std::size_t>(" + Low + ")")
+                             .str();
+  std::uint64_t Step = Down ? -Loop.Step : Loop.Step;
+  std::string Trips;
+  if (Loop.Inclusive)
+    Trips = Step == 1 ? Distance + " + 1"
+                      : "(" + Distance + ") / " + std::to_string(Step) + " + 1";
+  else if (Step == 1)
+    Trips = Distance;
+  else
+    Trips = "(" + Distance + " + " + std::to_string(Step - 1) + ") / " +
+            std::to_string(Step);
+  OS << I << "  const " << CountType << " " << Count << " =\n";
+  OS << I << "      " << Low << (Loop.Inclusive ? " <= " : " < ") << High
+     << " ? " << Trips << " : 0;\n";
+}
+
+// Declares `_par_n`, the number of iterations, see emitLoopSpace. The
+// iterations of a collapsed nest are numbered row by row; WithTotal is false
+// when only the sizes of its loops are needed.
+static void emitIterationSpace(raw_ostream &OS, Lowering &L,
+                               const LoopSource &Src, StringRef CountType,
+                               bool WithTotal = true) {
+  emitLoopSpace(OS, L, Src, CountType);
+  if (!Src.Inner)
+    return;
+  emitLoopSpace(OS, L, *Src.Inner, CountType);
+  if (WithTotal)
+    OS << Src.Indent << "  const " << CountType << " _par_n = "
+       << Src.name("_par_n") << " * " << Src.Inner->name("_par_n") << ";\n";
+}
+
+// Declares `_par_blocks`, the indices of the blocks the range is split into,
+// and everything needed to find the iterations of a block.
+//
+// Random-access and gathered ranges use blocks of a page worth of elements
+// unless `grain` says otherwise, rounded up to whole cache lines. For
+// contiguous ranges, block boundaries are also shifted onto cache-line
+// boundaries so that no two tasks write to the same line. Sequential ranges
+// have to be walked to be split, and the buckets of hashed ranges hold an
+// unknown number of elements, so they get one block per hardware thread
+// unless `grain` is given.
+// With `first_touch`, blocks are rounded to and aligned on whole pages
+// instead, so that every page is touched by a single thread.
+static void emitBlocks(raw_ostream &OS, Lowering &L, const LoopSource &Src,
+                       const ParallelOptions &Opts, RangeKind Kind,
+                       Backend Target) {
+  StringRef I = Src.Indent;
+  bool Indexed = isIndexed(Kind);
+  emitIterationSpace(OS, L, Src, "std::size_t");
+
+  if (Opts.Grain != 0) {
+    OS << I << "  const std::size_t _par_want = " << Opts.Grain << ";\n";
+  } else if (Opts.Sched == Schedule::Static || !Indexed) {
+    if (Target == Backend::Native) {
+      OS << I << "  const std::size_t _par_workers = "
+         << "parallel_rt::num_threads();\n";
+    } else {
+      L.require({"thread"});
+      OS << I << "  const std::size_t _par_workers = "
+         << "std::max(1u, std::thread::hardware_concurrency());\n";
+    }
+    OS << I << "  const std::size_t _par_want = "
+       << "(_par_n + _par_workers - 1) / _par_workers;\n";
+  } else {
+    OS << I << "  const std::size_t _par_want = 4096 / " << Src.elementSize()
+       << ";\n";
+  }
+
+  StringRef Boundary = Opts.FirstTouch ? "4096" : "64";
+  if (Indexed) {
+    OS << I << "  const std::size_t _par_line = "
+       << "std::max<std::size_t>(1, " << Boundary << " / "
+       << Src.elementSize() << ");\n";
+    OS << I << "  const std::size_t _par_grain = "
+       << "std::max(_par_line, (_par_want + _par_line - 1) / _par_line * "
+          "_par_line);\n";
+  } else {
+    OS << I << "  const std::size_t _par_grain = "
+       << "std::max<std::size_t>(1, _par_want);\n";
+  }
+  if (Kind == RangeKind::Contiguous) {
+    L.require({"cstdint", "memory"});
+    OS << I << "  const std::size_t _par_skew = _par_n == 0 ? 0 : "
+       << "reinterpret_cast<std::uintptr_t>(std::addressof(*_par_first)) % "
+       << Boundary << " / sizeof(*_par_first);\n";
+  } else {
+    OS << I << "  const std::size_t _par_skew = 0;\n";
+  }
+  if (Target == Backend::Native) {
+    OS << I << "  const std::size_t _par_nblocks = "
+       << "(_par_n + _par_skew + _par_grain - 1) / _par_grain;\n";
+    return;
+  }
+  L.require({"numeric", "vector"});
+  OS << I << "  std::vector<std::size_t> _par_blocks("
+     << "(_par_n + _par_skew + _par_grain - 1) / _par_grain);\n";
+  OS << I << "  std::iota(_par_blocks.begin(), _par_blocks.end(), "
+     << "std::size_t(0));\n";
+}
+
+// Number of blocks declared by emitBlocks.
+static StringRef blockCount(Backend Target) {
+  return Target == Backend::Native ? "_par_nblocks" : "_par_blocks.size()";
+}
+
+// Opens the call running `[&](std::size_t _par_b) { ... }` once per block.
+// With an `affinity` clause, the pinned workers of the native runtime run the
+// blocks round robin, so that a block always runs on the same CPU.
+static void emitBlockDispatch(raw_ostream &OS, Lowering &L,
+                              const ParallelOptions &Opts, Backend Target) {
+  if (Target == Backend::Native) {
+    L.require({"parallel_rt.h"});
+    if (Opts.Policy == ExecutionPolicy::Seq)
+      OS << "parallel_rt::serial_for(";
+    else if (Opts.Bind != Affinity::None)
+      OS << "parallel_rt::pinned_for(parallel_rt::affinity::"
+         << getAffinityName(Opts.Bind) << ", ";
+    else
+      OS << "parallel_rt::parallel_for(";
+    OS << "_par_nblocks, [&](std::size_t _par_b) {\n";
+    return;
+  }
+  L.require({"execution"});
+  OS << "std::for_each(" << policyExpr(Opts)
+     << ", _par_blocks.begin(), _par_blocks.end(), "
+     << "[&](std::size_t _par_b) {\n";
+}
+
+// `#pragma omp simd` with the reductions of Opts, for the loop over a block
+// of an unsequenced loop. Empty when the policy keeps iterations in order, or
+// when a reduction has a user combiner, which would need a `declare
+// reduction` of its own.
+static std::string blockSimdPragma(const ParallelOptions &Opts) {
+  if (Opts.Policy != ExecutionPolicy::ParUnseq &&
+      Opts.Policy != ExecutionPolicy::Unseq)
+    return "";
+  std::string Pragma = "#pragma omp simd";
+  for (const auto &R : Opts.Reductions) {
+    if (!R.isBuiltinOp())
+      return "";
+    Pragma += " reduction(" + R.Op + ": " + R.Var + ")";
+  }
+  return Pragma;
+}
+
+// Runs the body of a collapsed nest over the iterations of block `_par_b`,
+// one row of the outer loop at a time, so that the nested loop stays a
+// counted loop over a slice of its row:
+//
+//   std::size_t _par_i = _par_lo / _par_n1;
+//   std::size_t _par_j0 = _par_lo % _par_n1;
+//   for (std::size_t _par_k = _par_lo; _par_k < _par_hi; ++_par_i) {
+//     const std::size_t _par_j1 = ...end of the row, or of the block...;
+//     auto &row = _par_first0[_par_i];
+//     for (std::size_t _par_j = _par_j0; _par_j < _par_j1; ++_par_j) {
+//       auto &x = _par_first1[_par_j];
+//       ...
+//     }
+//     _par_k += _par_j1 - _par_j0;
+//     _par_j0 = 0;
+//   }
+static void emitCollapsedBlockLoop(raw_ostream &OS, const LoopSource &Src,
+                                   const ParallelOptions &Opts) {
+  const LoopSource &Inner = *Src.Inner;
+  std::string Row = Inner.name("_par_n");
+  StringRef I = Src.Indent;
+  OS << I << "    std::size_t _par_i = _par_lo / " << Row << ";\n";
+  OS << I << "    std::size_t _par_j0 = _par_lo % " << Row << ";\n";
+  OS << I << "    for (std::size_t _par_k = _par_lo; _par_k < _par_hi; "
+     << "++_par_i) {\n";
+  OS << I << "      const std::size_t _par_j1 = std::min(" << Row
+     << ", _par_j0 + (_par_hi - _par_k));\n";
+  OS << I << "      " << Src.Var << " = " << Src.element("_par_i") << ";\n";
+  std::string Pragma = blockSimdPragma(Opts);
+  if (!Pragma.empty())
+    OS << I << "      " << Pragma << "\n";
+  OS << I << "      for (std::size_t _par_j = _par_j0; _par_j < _par_j1; "
+     << "++_par_j) {\n";
+  OS << I << "        " << Inner.Var << " = " << Inner.element("_par_j")
+     << ";\n";
+  OS << I << "        " << Inner.Body << "\n";
+  OS << I << "      }\n";
+  OS << I << "      _par_k += _par_j1 - _par_j0;\n";
+  OS << I << "      _par_j0 = 0;\n";
+  OS << I << "    }\n";
+}
+
+// Runs the original body serially over the iterations of block `_par_b`.
+// Indexed ranges use a counted loop the compiler can vectorize, marked `omp
+// simd` when the policy is unsequenced. The iterations of a hashed range are
+// the buckets of the block.
+static void emitBlockLoop(raw_ostream &OS, const LoopSource &Src,
+                          const ParallelOptions &Opts, RangeKind Kind,
+                          bool Instrument) {
+  StringRef I = Src.Indent;
+  OS << I << "    const std::size_t _par_lo = "
+     << "_par_b == 0 ? 0 : _par_b * _par_grain - _par_skew;\n";
+  OS << I << "    const std::size_t _par_hi = "
+     << "std::min(_par_n, (_par_b + 1) * _par_grain - _par_skew);\n";
+  if (Instrument)
+    emitTaskProbe(OS, (I + "    ").str(), "_par_hi - _par_lo");
+  for (const std::string &Decl : Src.PrivateDecls)
+    OS << I << "    " << Decl << "\n";
+  if (Src.Inner) {
+    emitCollapsedBlockLoop(OS, Src, Opts);
+    return;
+  }
+  if (Kind == RangeKind::Hashed) {
+    std::string Range = Src.name("_par_range");
+    OS << I << "    for (std::size_t _par_k = _par_lo; _par_k < _par_hi; "
+       << "++_par_k) {\n";
+    OS << I << "      const auto _par_end = " << Range << ".end(_par_k);\n";
+    OS << I << "      for (auto _par_it = " << Range << ".begin(_par_k); "
+       << "_par_it != _par_end; ++_par_it) {\n";
+    OS << I << "        " << Src.Var << " = *_par_it;\n";
+    OS << I << "        " << Src.Body << "\n";
+    OS << I << "      }\n";
+    OS << I << "    }\n";
+    return;
+  }
+  if (isIndexed(Kind)) {
+    std::string Pragma = blockSimdPragma(Opts);
+    if (!Pragma.empty())
+      OS << I << "    " << Pragma << "\n";
+    OS << I << "    for (std::size_t _par_k = _par_lo; _par_k < _par_hi; "
+       << "++_par_k) {\n";
+    OS << I << "      " << Src.Var << " = " << Src.element("_par_k") << ";\n";
+  } else {
+    OS << I << "    auto _par_it = std::next(_par_first, _par_lo);\n";
+    OS << I << "    for (std::size_t _par_k = _par_lo; _par_k != _par_hi; "
+       << "++_par_k, ++_par_it) {\n";
+    OS << I << "      " << Src.Var << " = *_par_it;\n";
+  }
+  OS << I << "      " << Src.Body << "\n";
+  OS << I << "    }\n";
+}
+
+static std::string reductionType(const Reduction &R) {
+  return "_par_" + R.Var + "_t";
+}
+
+// Value every private copy of a reduction variable starts from.
+static std::string reductionIdentity(const Reduction &R, Lowering &L) {
+  std::string Type = reductionType(R);
+  if (R.Op == "*")
+    return Type + "(1)";
+  if (R.Op == "min" || R.Op == "max") {
+    L.require({"limits"});
+    return "std::numeric_limits<" + Type + ">::" +
+           (R.Op == "min" ? "max" : "lowest") + "()";
+  }
+  return Type + "{}";
+}
+
+static std::string reductionCombine(const Reduction &R, StringRef LHS,
+                                    StringRef RHS) {
+  if (R.Op == "+" || R.Op == "*")
+    return (LHS + " " + R.Op + " " + RHS).str();
+  StringRef Prefix = R.isBuiltinOp() ? "std::" : "";
+  return (Prefix + R.Op + "(" + LHS + ", " + RHS + ")").str();
+}
+
+// Declares the private copies of the reduction variables inside a task. They
+// shadow the variables of the enclosing scope, so the body is left untouched.
+static void emitPrivateReductions(raw_ostream &OS, Lowering &L,
+                                  const LoopSource &Src,
+                                  const ParallelOptions &Opts) {
+  for (const auto &R : Opts.Reductions)
+    OS << Src.Indent << "    " << reductionType(R) << " " << R.Var << " = "
+       << reductionIdentity(R, L) << ";\n";
+}
+
+static std::string appendType(const VarDecl &Container) {
+  return "_par_" + Container.getNameAsString() + "_t";
+}
+
+// Declares the private containers a task appends to instead of the ones of
+// the enclosing scope, which they shadow like private reduction variables.
+static void emitPrivateAppends(raw_ostream &OS, const LoopSource &Src,
+                               ArrayRef<const VarDecl *> Appends) {
+  for (const VarDecl *Container : Appends)
+    OS << Src.Indent << "    " << appendType(*Container) << " "
+       << Container->getName() << ";\n";
+}
+
+// Appends the parts of every task to the containers, in block order. Lists
+// are spliced, vectors and strings make room for all parts at once.
+static void emitAppendParts(raw_ostream &OS, Lowering &L, const LoopSource &Src,
+                            ArrayRef<const VarDecl *> Appends) {
+  StringRef I = Src.Indent;
+  for (const VarDecl *Container : Appends) {
+    std::string Name = Container->getNameAsString();
+    std::string Part = "_par_" + Name + "_part";
+    std::string Parts = "_par_" + Name + "_parts";
+    StringRef Kind = Container->getType()
+                         .getNonReferenceType()
+                         ->getAsCXXRecordDecl()
+                         ->getName();
+    if (Kind == "list") {
+      OS << I << "  for (auto &" << Part << " : " << Parts << ")\n";
+      OS << I << "    " << Name << ".splice(" << Name << ".end(), " << Part
+         << ");\n";
+      continue;
+    }
+    if (Kind != "deque") {
+      OS << I << "  std::size_t _par_" << Name << "_size = " << Name
+         << ".size();\n";
+      OS << I << "  for (const auto &" << Part << " : " << Parts << ")\n";
+      OS << I << "    _par_" << Name << "_size += " << Part << ".size();\n";
+      OS << I << "  " << Name << ".reserve(_par_" << Name << "_size);\n";
+    }
+    L.require({"iterator"});
+    OS << I << "  for (auto &" << Part << " : " << Parts << ")\n";
+    OS << I << "    " << Name << ".insert(" << Name
+       << ".end(), std::make_move_iterator(" << Part << ".begin()),\n";
+    OS << I << "                  std::make_move_iterator(" << Part
+       << ".end()));\n";
+  }
+}
+
+// Splits the range into blocks and dispatches one task per block, see
+// emitBlocks. Without reductions, every task runs the body over its block
+// with std::for_each. A single reduction variable is lowered to
+// std::transform_reduce over the blocks. Several reduction variables keep one
+// partial result per block, combined in block order once all tasks finished.
+// Containers the body only appends to, see findOrderedAppends, are kept the
+// same way: every task appends to a container of its own, and the parts are
+// moved to the original container in block order, which is the order of the
+// iterations.
+//
+// The native backend always keeps one partial result per block: the blocks
+// only depend on the range and `grain`, so the result does not depend on the
+// number of threads or on which thread ran which block.
+static Lowering lowerBlocked(const LoopSource &Src, const ParallelOptions &Opts,
+                             ArrayRef<const VarDecl *> Appends, RangeKind Kind,
+                             const LoweringOptions &Options) {
+  Backend Target = Options.Target;
+  Lowering L;
+  L.require({"algorithm"});
+  StringRef I = Src.Indent;
+  raw_string_ostream OS(L.Text);
+  OS << "{\n";
+  emitBlocks(OS, L, Src, Opts, Kind, Target);
+  if (!Opts.Reductions.empty() || !Appends.empty())
+    L.require({"type_traits"});
+  for (const auto &R : Opts.Reductions)
+    OS << I << "  using " << reductionType(R) << " = std::decay_t<decltype("
+       << R.Var << ")>;\n";
+  for (const VarDecl *Container : Appends)
+    OS << I << "  using " << appendType(*Container)
+       << " = std::decay_t<decltype(" << Container->getName() << ")>;\n";
+
+  if (Opts.Reductions.size() == 1 && Appends.empty() &&
+      Target != Backend::Native) {
+    L.require({"execution", "numeric"});
+    const Reduction &R = Opts.Reductions.front();
+    std::string Type = reductionType(R);
+    OS << I << "  " << R.Var << " = std::transform_reduce(" << policyExpr(Opts)
+       << ", _par_blocks.begin(), _par_blocks.end(), " << R.Var << ",\n";
+    OS << I << "    [&](const " << Type << " &_par_x, const " << Type
+       << " &_par_y) { return " << reductionCombine(R, "_par_x", "_par_y")
+       << "; },\n";
+    OS << I << "    [&](std::size_t _par_b) {\n";
+    emitPrivateReductions(OS, L, Src, Opts);
+    emitBlockLoop(OS, Src, Opts, Kind, Options.Instrument);
+    OS << I << "    return " << R.Var << ";\n";
+    OS << I << "  });\n";
+    OS << I << "}";
+    return L;
+  }
+
+  if (!Opts.Reductions.empty() || !Appends.empty())
+    L.require({"vector"});
+  for (const auto &R : Opts.Reductions)
+    OS << I << "  std::vector<" << reductionType(R) << "> _par_" << R.Var
+       << "_parts(" << blockCount(Target) << ");\n";
+  for (const VarDecl *Container : Appends)
+    OS << I << "  std::vector<" << appendType(*Container) << "> _par_"
+       << Container->getName() << "_parts(" << blockCount(Target) << ");\n";
+  OS << I << "  ";
+  emitBlockDispatch(OS, L, Opts, Target);
+  emitPrivateReductions(OS, L, Src, Opts);
+  emitPrivateAppends(OS, Src, Appends);
+  emitBlockLoop(OS, Src, Opts, Kind, Options.Instrument);
+  for (const auto &R : Opts.Reductions)
+    OS << I << "    _par_" << R.Var << "_parts[_par_b] = " << R.Var << ";\n";
+  if (!Appends.empty())
+    L.require({"utility"});
+  for (const VarDecl *Container : Appends)
+    OS << I << "    _par_" << Container->getName()
+       << "_parts[_par_b] = std::move(" << Container->getName() << ");\n";
+  OS << I << "  });\n";
+  for (const auto &R : Opts.Reductions) {
+    std::string Part = "_par_" + R.Var + "_part";
+    OS << I << "  for (const auto &" << Part << " : _par_" << R.Var
+       << "_parts)\n";
+    OS << I << "    " << R.Var << " = " << reductionCombine(R, R.Var, Part)
+       << ";\n";
+  }
+  emitAppendParts(OS, L, Src, Appends);
+  OS << I << "}";
+  return L;
+}
+
+// Schedule clause of the OpenMP lowering, empty to leave it to the runtime.
+// `grain` becomes the chunk size, dispatched dynamically unless another
+// schedule is asked for.
+static std::string ompSchedule(const ParallelOptions &Opts) {
+  if (Opts.Sched == Schedule::Auto && Opts.Grain == 0)
+    return "";
+  StringRef Kind = Opts.Sched == Schedule::Auto ? "dynamic"
+                                                : getScheduleName(Opts.Sched);
+  std::string Clause = (" schedule(" + Kind).str();
+  if (Opts.Grain != 0)
+    Clause += ", " + std::to_string(Opts.Grain);
+  return Clause + ")";
+}
+
+// Name of the `declare reduction` identifier of a user-supplied combiner.
+static std::string ompReductionId(const Reduction &R) {
+  return "_par_" + R.Var + "_op";
+}
+
+// {
+//   auto &&_par_range = r;
+//   ...
+//   #pragma omp parallel for schedule(...) reduction(...)
+//   for (std::ptrdiff_t _par_k = 0; _par_k < _par_n; ++_par_k) {
+//     auto &i = _par_first[_par_k];
+//     ...
+//   }
+// }
+//
+// The policy picks the directive: `unseq` policies add `simd`, `seq` keeps a
+// plain loop. Reductions use the `reduction` clause on the original names,
+// which OpenMP privatizes like the other lowerings do; a user combiner gets a
+// block scope `declare reduction`. A collapsed nest keeps both loops, under a
+// `collapse(2)` clause. `affinity` becomes `proc_bind`, with a static
+// schedule.
+//
+// When instrumented, a `parallel` loop is split into `omp parallel` and a
+// `nowait` worksharing loop, so that every thread of the team times its share
+// of the iterations as one task. OpenMP does not tell how many iterations
+// that is, so the call counts them. Loops kept on the calling thread are a
+// single task.
+static Lowering lowerOpenMP(const LoopSource &Src, const ParallelOptions &Opts,
+                            bool Instrument) {
+  Lowering L;
+  L.require({"cstddef"});
+  StringRef I = Src.Indent;
+  raw_string_ostream OS(L.Text);
+  OS << "{\n";
+  emitIterationSpace(OS, L, Src, "std::ptrdiff_t",
+                     /*WithTotal=*/!Src.Inner || Instrument);
+
+  StringRef Directive;
+  switch (Opts.Policy) {
+  case ExecutionPolicy::Seq:
+    break;
+  case ExecutionPolicy::Par:
+    Directive = "parallel for";
+    break;
+  case ExecutionPolicy::ParUnseq:
+    Directive = "parallel for simd";
+    break;
+  case ExecutionPolicy::Unseq:
+    Directive = "simd";
+    break;
+  }
+  bool TaskPerThread = Instrument && Directive.starts_with("parallel");
+  std::string LoopIndent = (I + (TaskPerThread ? "    " : "  ")).str();
+  if (TaskPerThread)
+    OS << I << "  " << ProbeCall << ".add(_par_n);\n";
+  else if (Instrument)
+    emitTaskProbe(OS, (I + "  ").str(), "_par_n");
+  for (const std::string &Decl : Src.PrivateDecls)
+    OS << I << "  " << Decl << "\n";
+  if (!Directive.empty()) {
+    if (!Opts.Reductions.empty())
+      L.require({"type_traits"});
+    for (const auto &R : Opts.Reductions) {
+      if (R.isBuiltinOp())
+        continue;
+      std::string Type = reductionType(R);
+      OS << I << "  using " << Type << " = std::decay_t<decltype(" << R.Var
+         << ")>;\n";
+      OS << I << "  #pragma omp declare reduction(" << ompReductionId(R)
+         << " : " << Type << " : omp_out = "
+         << reductionCombine(R, "omp_out", "omp_in")
+         << ") initializer(omp_priv = " << reductionIdentity(R, L) << ")\n";
+    }
+    std::string ProcBind;
+    if (Opts.Bind != Affinity::None)
+      ProcBind = (" proc_bind(" + getAffinityName(Opts.Bind) + ")").str();
+    if (TaskPerThread) {
+      OS << I << "  #pragma omp parallel" << ProcBind << "\n";
+      OS << I << "  {\n";
+      emitTaskProbe(OS, LoopIndent, "0");
+      Directive.consume_front("parallel ");
+    }
+    OS << LoopIndent << "#pragma omp " << Directive;
+    if (Directive.starts_with("parallel"))
+      OS << ProcBind;
+    if (Src.Inner)
+      OS << " collapse(2)";
+    if (Directive != "simd")
+      OS << ompSchedule(Opts);
+    for (const auto &R : Opts.Reductions)
+      OS << " reduction(" << (R.isBuiltinOp() ? R.Op : ompReductionId(R))
+         << ": " << R.Var << ")";
+    if (!Opts.Privates.empty())
+      OS << " private(" << join(Opts.Privates, ", ") << ")";
+    if (TaskPerThread)
+      OS << " nowait";
+    OS << "\n";
+  }
+  if (Src.Inner) {
+    // Nothing may come between the loops of a `collapse` nest.
+    const LoopSource &Inner = *Src.Inner;
+    OS << LoopIndent << "for (std::ptrdiff_t _par_i = 0; _par_i < "
+       << Src.name("_par_n") << "; ++_par_i) {\n";
+    OS << LoopIndent << "  for (std::ptrdiff_t _par_j = 0; _par_j < "
+       << Inner.name("_par_n") << "; ++_par_j) {\n";
+    OS << LoopIndent << "    " << Src.Var << " = " << Src.element("_par_i")
+       << ";\n";
+    OS << LoopIndent << "    " << Inner.Var << " = "
+       << Inner.element("_par_j") << ";\n";
+    OS << LoopIndent << "    " << Inner.Body << "\n";
+    OS << LoopIndent << "  }\n";
+  } else {
+    OS << LoopIndent
+       << "for (std::ptrdiff_t _par_k = 0; _par_k < _par_n; ++_par_k) {\n";
+    OS << LoopIndent << "  " << Src.Var << " = " << Src.element("_par_k")
+       << ";\n";
+    OS << LoopIndent << "  " << Src.Body << "\n";
+  }
+  OS << LoopIndent << "}\n";
+  if (TaskPerThread)
+    OS << I << "  }\n";
+  OS << I << "}";
+  return L;
+}
+
+// Declares the probe of the region, keyed by the location of the loop, and
+// the probe timing its execution in front of the lowering.
+static void wrapInstrumented(Lowering &L, const LoopSource &Src,
+                             const Stmt &For, const SourceManager &SM) {
+  L.require({"parallel_probe.h"});
+  PresumedLoc Loc = SM.getPresumedLoc(For.getBeginLoc());
+  std::string Text;
+  raw_string_ostream OS(Text);
+  OS << "{\n";
+  OS << Src.Indent << "  static parallel_probe::Region " << ProbeRegion
+     << "(\"";
+  OS.write_escaped(Loc.getFilename());
+  OS << "\", " << Loc.getLine() << ");\n";
+  OS << Src.Indent << "  parallel_probe::Call " << ProbeCall << "("
+     << ProbeRegion << ");\n";
+  // Every lowering but std::for_each already opens a block.
+  StringRef Lowered = L.Text;
+  if (Lowered.consume_front("{\n"))
+    OS << Lowered;
+  else
+    OS << Src.Indent << "  " << L.Text << "\n" << Src.Indent << "}";
+  L.Text = std::move(Text);
+}
+
+// Whether Range can be evaluated once more for the serial guard: it names an
+// object without side effects, like `v` or `s.items`.
+static bool isReevaluable(const Expr &Range, ASTContext &Ctx) {
+  return Range.isLValue() && !Range.HasSideEffects(Ctx);
+}
+
+// Condition of the serial guard, true when the loop runs fewer than
+// MinIterations iterations. Empty when it cannot be evaluated up front.
+static std::string serialGuard(const Stmt &For, const LoopSource &Src,
+                               std::uint64_t MinIterations, ASTContext &Ctx) {
+  if (!Src.Counted) {
+    const Expr *Range = cast<CXXForRangeStmt>(For).getRangeInit();
+    if (!Range || !isReevaluable(*Range, Ctx))
+      return "";
+    return "std::end(" + Src.Range + ") - std::begin(" + Src.Range +
+           ") < " + std::to_string(MinIterations);
+  }
+  // (end - begin) / step < N, or (begin - end) / -step < N counting down.
+  const CountedLoop &Loop = *Src.Counted;
+  if (Loop.Begin->HasSideEffects(Ctx) || Loop.End->HasSideEffects(Ctx))
+    return "";
+  bool Down = Loop.Step < 0;
+  const Expr *Low = Down ? Loop.End : Loop.Begin;
+  StringRef LowText = Down ? Src.End : Src.Begin;
+  StringRef HighText = Down ? Src.Begin : Src.End;
+  std::uint64_t Step = Down ? -Loop.Step : Loop.Step;
+  std::string Distance = HighText.str();
+  if (auto Value = Low->getIntegerConstantExpr(Ctx); !Value || !Value->isZero())
+    Distance += " - (" + LowText.str() + ")";
+  return Distance + " < " + std::to_string(MinIterations * Step);
+}
+
+// Whether Attr marks the nested loop of a nest collapsed by the `[[parallel]]`
+// loop enclosing it, whose lowering covers both loops.
+static bool isCollapsedIntoParent(const AttributedStmt &Attr,
+                                  ASTContext &Ctx) {
+  auto Parents = Ctx.getParents(Attr);
+  const auto *Body =
+      Parents.size() == 1 ? Parents[0].get<CompoundStmt>() : nullptr;
+  if (!Body)
+    return false;
+  Parents = Ctx.getParents(*Body);
+  const auto *Outer = Parents.size() == 1 ? Parents[0].get<Stmt>() : nullptr;
+  if (!isa_and_nonnull<CXXForRangeStmt, ForStmt>(Outer))
+    return false;
+  Parents = Ctx.getParents(*Outer);
+  const auto *OuterAttr =
+      Parents.size() == 1 ? Parents[0].get<AttributedStmt>() : nullptr;
+  if (!OuterAttr || !getParallelAnnotation(*OuterAttr))
+    return false;
+  auto Opts = getParallelOptions(*OuterAttr);
+  if (!Opts) {
+    consumeError(Opts.takeError());
+    return false;
+  }
+  auto Inner = getCollapsedLoop(*Outer, *Opts, Ctx);
+  if (!Inner) {
+    consumeError(Inner.takeError());
+    return false;
+  }
+  return *Inner == Attr.getSubStmt();
+}
+
+// Source of the matched loop, run as it is when parallel execution does not
+// pay off, followed by the loops fused with it, see getFusedLoops. The
+// attributes of a nested loop collapsed with it and of the fused loops are
+// dropped too.
+static Expected<std::string>
+serialText(const MatchFinder::MatchResult &Result, const LoopSource &Src,
+           ArrayRef<const AttributedStmt *> Fused) {
+  SmallVector<const AttributedStmt *, 2> Dropped(Fused.drop_front());
+  if (Src.Inner) {
+    const auto *Body = cast<CompoundStmt>(getLoopBody(*Src.Loop));
+    if (const auto *Nested = dyn_cast<AttributedStmt>(Body->body_front()))
+      Dropped.insert(Dropped.begin(), Nested);
+  }
+  auto Serial =
+      Fused.size() > 1
+          ? Expected<std::string>(
+                tooling::getText(
+                    CharSourceRange::getTokenRange(Src.Loop->getBeginLoc(),
+                                                   Fused.back()->getEndLoc()),
+                    *Result.Context)
+                    .str())
+          : selectText(node("for"), Result);
+  if (!Serial)
+    return Serial;
+  // Erase from the back, so that the offsets of the others stay valid.
+  const SourceManager &SM = *Result.SourceManager;
+  unsigned Start = SM.getFileOffset(Src.Loop->getBeginLoc());
+  for (const AttributedStmt *Attr : reverse(Dropped)) {
+    unsigned AttrBegin = SM.getFileOffset(Attr->getBeginLoc());
+    unsigned LoopBegin = SM.getFileOffset(Attr->getSubStmt()->getBeginLoc());
+    Serial->erase(AttrBegin - Start, LoopBegin - AttrBegin);
+  }
+  return Serial;
+}
+
+// {
+//   {
+//     auto &x = _par_elem;
+//     { ...body of the first loop... }
+//   }
+//   {
+//     auto &y = _par_elem;
+//     { ...body of the second loop... }
+//   }
+// }
+//
+// Runs the bodies of the loops fused with Src on every element in turn, each
+// in a scope of its own where its loop variable is bound to the element.
+static void fuseLoopBodies(LoopSource &Src,
+                           ArrayRef<const AttributedStmt *> Fused,
+                           ASTContext &Ctx) {
+  std::string Body;
+  raw_string_ostream OS(Body);
+  OS << "{\n";
+  for (const AttributedStmt *Attr : Fused) {
+    LoopSource Loop;
+    cantFail(collectLoopHeader(Loop, *Attr->getSubStmt(), Ctx));
+    OS << Src.Indent << "  {\n";
+    OS << Src.Indent << "    " << Loop.Var << " = _par_elem;\n";
+    OS << Src.Indent << "    " << Loop.Body << "\n";
+    OS << Src.Indent << "  }\n";
+  }
+  OS << Src.Indent << "}";
+  Src.Var = "auto &&_par_elem";
+  Src.Body = std::move(Body);
+}
+
+// h = std::async(std::launch::async, [&] {
+//   ...lowering...
+// });
+//
+// The loop runs on a thread of its own while the enclosing scope goes on,
+// until the std::future `h` declared before the loop is waited for. A future
+// of std::async also blocks in its destructor, so the loop is joined when `h`
+// goes out of scope at the latest, see findAsyncConflicts.
+static void wrapAsync(Lowering &L, const LoopSource &Src, StringRef Handle) {
+  L.require({"future"});
+  std::string Text;
+  raw_string_ostream OS(Text);
+  OS << Handle << " = std::async(std::launch::async, [&] {\n";
+  OS << Src.Indent << "  ";
+  for (char C : L.Text) {
+    OS << C;
+    if (C == '\n')
+      OS << "  ";
+  }
+  OS << "\n" << Src.Indent << "});";
+  L.Text = std::move(Text);
+}
+
+// Replaces Target with the lowering, and adds the headers it relies on.
+static SmallVector<Edit, 1> makeEdits(Lowering L, CharSourceRange Target) {
+  SmallVector<Edit, 1> Edits;
+  for (StringRef Header : L.Headers) {
+    Edit Include;
+    Include.Kind = EditKind::AddInclude;
+    Include.Range = Target;
+    Include.Replacement = ("<" + Header + ">").str();
+    Edits.push_back(std::move(Include));
+  }
+  Edit Replace;
+  Replace.Range = Target;
+  Replace.Replacement = std::move(L.Text);
+  Edits.push_back(std::move(Replace));
+  return Edits;
+}
+
+static EditGenerator lowerParallelFor(LoweringOptions Options) {
+  return [Options](const MatchFinder::MatchResult &Result)
+             -> Expected<SmallVector<Edit, 1>> {
+    const auto *Attr = Result.Nodes.getNodeAs<AttributedStmt>("attr");
+    if (isCollapsedIntoParent(*Attr, *Result.Context))
+      return SmallVector<Edit, 1>();
+    // The first loop of a fused run is rewritten into the whole run.
+    SmallVector<const AttributedStmt *, 2> Fused = {Attr};
+    if (Options.Fuse)
+      Fused = getFusedLoops(*Attr, *Result.Context);
+    if (Fused.front() != Attr)
+      return SmallVector<Edit, 1>();
+    auto Opts = getParallelOptions(*Attr);
+    if (!Opts)
+      return Opts.takeError();
+    auto Src = collectLoopSource(Result, *Opts);
+    if (!Src)
+      return Src.takeError();
+    auto Target = node("attr")(Result);
+    if (!Target)
+      return Target.takeError();
+    auto Serial = serialText(Result, *Src, Fused);
+    if (!Serial)
+      return Serial.takeError();
+    if (Fused.size() > 1) {
+      fuseLoopBodies(*Src, Fused, *Result.Context);
+      Target->setEnd(Fused.back()->getEndLoc());
+    }
+
+    // Counted loops and collapsed nests compute their indices, like
+    // random-access iterators.
+    const auto *For = Result.Nodes.getNodeAs<Stmt>("for");
+    RangeKind Kind = RangeKind::RandomAccess;
+    const auto *Range = dyn_cast<CXXForRangeStmt>(For);
+    if (Range && !Src->Inner) {
+      Kind = classifyRange(*Range, *Result.Context);
+      Src->Data = hasContiguousData(*Range);
+    }
+
+    // Cost model: keep loops that are too cheap serial, or guard them when
+    // their trip count is only known at runtime. A collapsed nest runs the
+    // body of its nested loop once per iteration of both loops.
+    std::string Guard;
+    if (Options.MinParallelWork != 0 && Opts->Policy != ExecutionPolicy::Seq) {
+      const Stmt &Innermost = Src->Inner ? *Src->Inner->Loop : *For;
+      std::uint64_t Cost = estimateIterationCost(*getLoopBody(Innermost));
+      for (const AttributedStmt *Next : drop_begin(Fused))
+        Cost += estimateIterationCost(*getLoopBody(*Next->getSubStmt()));
+      auto Trip = getTripCount(*For, *Result.Context);
+      if (Trip && Src->Inner) {
+        auto InnerTrip = getTripCount(Innermost, *Result.Context);
+        if (Trip->Exact && InnerTrip && InnerTrip->Exact)
+          Trip->Count *= InnerTrip->Count;
+        else
+          Trip.reset();
+      }
+      if (Trip && Trip->Exact) {
+        if (isTooCheap(Trip->Count, Cost, Options.MinParallelWork)) {
+          Lowering L;
+          L.Text = std::move(*Serial);
+          if (!Opts->Async.empty())
+            wrapAsync(L, *Src, Opts->Async);
+          return makeEdits(std::move(L), *Target);
+        }
+      } else if (isRandomAccess(Kind) && !Src->Inner) {
+        std::uint64_t MinIterations = Options.MinParallelWork / Cost +
+                                      (Options.MinParallelWork % Cost != 0);
+        if (MinIterations > 1)
+          Guard = serialGuard(*For, *Src, MinIterations, *Result.Context);
+      }
+    }
+
+    // Bodies that are safe to interleave run unsequenced, unless the
+    // attribute asks for a policy. Probes lock a mutex and keep their
+    // counters in thread_local storage, neither of which `par_unseq` allows.
+    if (!Opts->isExplicit("policy") && !Options.Instrument &&
+        all_of(Fused, [&](const AttributedStmt *Loop) {
+          return findVectorizeBlockers(*Loop->getSubStmt(), *Opts).empty();
+        }))
+      Opts->Policy = ExecutionPolicy::ParUnseq;
+
+    // Appends keep their order through one container per block, which the
+    // OpenMP lowering has no notion of.
+    SmallVector<const VarDecl *, 2> Appends = findOrderedAppends(*For, *Opts);
+    // Buckets are not in iteration order, gathered elements are.
+    if (Kind == RangeKind::Hashed && !Appends.empty())
+      Kind = RangeKind::Gathered;
+    Src->Kind = Kind;
+    // Pinned threads and a static split come from the native runtime, or
+    // from `proc_bind` and `schedule(static)` under OpenMP.
+    LoweringOptions BlockOptions = Options;
+    if (Opts->Bind != Affinity::None) {
+      Opts->Sched = Schedule::Static;
+      BlockOptions.Target = Backend::Native;
+    }
+    Lowering L;
+    if (Options.Target == Backend::OpenMP && isIndexed(Kind) &&
+        Appends.empty())
+      L = lowerOpenMP(*Src, *Opts, Options.Instrument);
+    else if (BlockOptions.Target == Backend::Native ||
+             Kind != RangeKind::Sequential || needsChunking(*Opts) ||
+             !Appends.empty() || Options.Instrument)
+      L = lowerBlocked(*Src, *Opts, Appends, Kind, BlockOptions);
+    else
+      L = lowerForEach(*Src, *Opts);
+    if (Options.Instrument)
+      wrapInstrumented(L, *Src, *For, *Result.SourceManager);
+
+    // if (std::end(r) - std::begin(r) < N) {
+    //   for (auto &i : r) { ... }
+    // } else {
+    //   ...parallel lowering...
+    // }
+    if (!Guard.empty()) {
+      if (!Src->Counted)
+        L.require({"iterator"});
+      std::string Guarded;
+      raw_string_ostream OS(Guarded);
+      OS << "if (" << Guard << ") {\n";
+      OS << Src->Indent << "  " << *Serial << "\n";
+      OS << Src->Indent << "} else " << L.Text;
+      L.Text = std::move(Guarded);
+    }
+    if (!Opts->Async.empty())
+      wrapAsync(L, *Src, Opts->Async);
+    return makeEdits(std::move(L), *Target);
+  };
+}
+
+transformer::RewriteRule
+clang::parallel::buildParallelRule(LoweringOptions Options) {
+  return transformer::makeRule(buildParallelForMatcher(),
+                               lowerParallelFor(Options));
+}
+
+EditGenerator clang::parallel::buildParallelLowering(LoweringOptions Options) {
+  return lowerParallelFor(Options);
+}
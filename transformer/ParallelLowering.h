@@ -0,0 +1,50 @@
+#ifndef PARALLEL_LOWERING_H
+#define PARALLEL_LOWERING_H
+#include "CostModel.h"
+#include "clang/ASTMatchers/ASTMatchers.h"
+#include "clang/Tooling/Transformer/RewriteRule.h"
+#include <cstdint>
+
+namespace clang::parallel {
+
+// Parallel runtime the rewritten loops are written against.
+enum class Backend {
+  // C++17 parallel algorithms of <execution>.
+  StdExecution,
+  // `#pragma omp parallel for` over an index loop, for random-access ranges.
+  // Other ranges keep the <execution> lowering.
+  OpenMP,
+  // parallel_rt::parallel_for of the header-only runtime in runtime/.
+  Native,
+};
+
+// Settings of the rewrite shared by every loop of a run.
+struct LoweringOptions {
+  Backend Target = Backend::StdExecution;
+  // Loops estimated to do less work than this are kept serial, see
+  // CostModel.h. When the trip count is only known at runtime, a guard runs
+  // the serial loop below the matching number of iterations. 0 parallelizes
+  // every loop.
+  std::uint64_t MinParallelWork = DefaultMinParallelWork;
+  // Adds the probes of runtime/parallel_probe.h to every parallel region.
+  bool Instrument = false;
+  // Rewrites adjacent loops over the same range into a single parallel loop,
+  // see getFusedLoops.
+  bool Fuse = true;
+};
+
+// Matches a `[[parallel]]` for-range loop, binding "attr", "for", "body",
+// "var" and "range".
+ast_matchers::StatementMatcher buildParallelForMatcher();
+
+// Rewrites every matched loop into a call of a parallel algorithm, honoring
+// the clauses given to the attribute.
+transformer::RewriteRule buildParallelRule(LoweringOptions Options = {});
+
+// The edits buildParallelRule makes for a loop matched by
+// buildParallelForMatcher, for clients running their own matcher.
+transformer::EditGenerator buildParallelLowering(LoweringOptions Options = {});
+
+} // namespace clang::parallel
+
+#endif
@@ -1,112 +1,366 @@
-#include "attributedStmtMatcher.h"
+#include "ParallelLowering.h"
+#include "SharedPreambles.h"
+#include "SourceChanges.h"
+#include "TransformCache.h"
 
 #include "clang/ASTMatchers/ASTMatchFinder.h"
 #include "clang/ASTMatchers/ASTMatchers.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/FrontendActions.h"
+#include "clang/Frontend/Utils.h"
 #include "clang/Tooling/CommonOptionsParser.h"
 #include "clang/Tooling/Refactoring/AtomicChange.h"
 #include "clang/Tooling/Tooling.h"
-#include "clang/Tooling/Transformer/RangeSelector.h"
-#include "clang/Tooling/Transformer/RewriteRule.h"
-#include "clang/Tooling/Transformer/Stencil.h"
 #include "clang/Tooling/Transformer/Transformer.h"
 #include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallString.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/VirtualFileSystem.h"
+#include "llvm/Support/Threading.h"
 #include "llvm/Support/raw_ostream.h"
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <vector>
 
 using namespace llvm;
 using namespace clang;
 using namespace tooling;
 using namespace ast_matchers;
-using transformer::addInclude;
-using transformer::cat;
-using transformer::changeTo;
-using transformer::IncludeFormat;
-using transformer::makeRule;
-using transformer::node;
 
 static cl::OptionCategory
     ParallelTransformCategory("parallel-transform options");
 
-static StatementMatcher buildMatcher() {
-  return attributedStmt(
-             hasParallelAttribute(
-                 cxxForRangeStmt(hasBody(compoundStmt().bind("body")),
-                                 hasLoopVariable(varDecl().bind("var")),
-                                 hasRangeInit(expr().bind("range")))
-                     .bind("for")))
-      .bind("attr");
-}
+static cl::opt<unsigned>
+    Jobs("j",
+         cl::desc("Number of translation units transformed concurrently, "
+                  "0 uses every hardware thread"),
+         cl::init(1), cl::cat(ParallelTransformCategory));
+
+static cl::opt<parallel::Backend> TargetBackend(
+    "backend", cl::desc("Parallel runtime the rewritten loops use"),
+    cl::values(clEnumValN(parallel::Backend::StdExecution, "std",
+                          "C++17 <execution> algorithms (default)"),
+               clEnumValN(parallel::Backend::OpenMP, "openmp",
+                          "#pragma omp parallel for over random-access "
+                          "ranges, build with -fopenmp"),
+               clEnumValN(parallel::Backend::Native, "native",
+                          "Work-stealing runtime of runtime/parallel_rt.h")),
+    cl::init(parallel::Backend::StdExecution),
+    cl::cat(ParallelTransformCategory));
+
+static cl::opt<std::uint64_t> MinParallelWork(
+    "min-parallel-work",
+    cl::desc("Estimated operations below which a loop is kept serial, or "
+             "guarded by a serial fallback when its trip count is only known "
+             "at runtime; 0 parallelizes every loop"),
+    cl::init(parallel::DefaultMinParallelWork),
+    cl::cat(ParallelTransformCategory));
+
+static cl::opt<bool> Instrument(
+    "instrument",
+    cl::desc("Record calls, elements, wall and per-thread busy time of every "
+             "parallel region, see runtime/parallel_probe.h"),
+    cl::cat(ParallelTransformCategory));
+
+static cl::opt<bool>
+    Fuse("fuse",
+         cl::desc("Run adjacent parallel loops over the same range as one "
+                  "parallel loop when their bodies do not depend on each "
+                  "other (default on)"),
+         cl::init(true), cl::cat(ParallelTransformCategory));
+
+static cl::opt<bool>
+    InPlace("in-place",
+            cl::desc("Overwrite every rewritten file instead of printing it"),
+            cl::cat(ParallelTransformCategory));
+
+static cl::opt<std::string>
+    OutputDir("output-dir",
+              cl::desc("Write every rewritten file below this directory, "
+                       "mirroring its path, instead of printing it"),
+              cl::value_desc("dir"), cl::cat(ParallelTransformCategory));
+
+static cl::opt<std::string>
+    CacheDir("cache-dir",
+             cl::desc("Reuse the changes of translation units whose sources "
+                      "and flags did not change since the last run"),
+             cl::value_desc("dir"), cl::cat(ParallelTransformCategory));
+
+static cl::opt<bool>
+    PreScan("prescan",
+            cl::desc("Skip main files that do not spell 'parallel' without "
+                     "parsing them, which misses parallel loops of the "
+                     "headers they include"),
+            cl::cat(ParallelTransformCategory));
+
+static cl::opt<bool> SharePreamble(
+    "share-preamble",
+    cl::desc("Parse the system headers main files start with once per set of "
+             "compile flags, into a precompiled header the translation units "
+             "load"),
+    cl::cat(ParallelTransformCategory));
+
+// Changes and outcome of transforming one translation unit.
+struct TUResult {
+  AtomicChanges Changes;
+  bool Failed = false;
+  // Not parsed, because the main file does not mention `parallel` or the
+  // changes were replayed from the cache.
+  bool Skipped = false;
+  bool Cached = false;
+  double Seconds = 0;
+};
+
+namespace {
+// Records every file read, system headers included, since a change to any of
+// them may change the loops matched.
+class AllDependencyCollector : public DependencyCollector {
+  bool needSystemDependencies() override { return true; }
+};
+
+// Runs the matchers like newFrontendActionFactory(&Finder) and reports the
+// files read by the translation unit, as absolute paths.
+class CollectingActionFactory : public FrontendActionFactory {
+public:
+  CollectingActionFactory(MatchFinder &Finder,
+                          std::vector<std::string> &Dependencies)
+      : Finder(Finder), Dependencies(Dependencies) {}
+
+  std::unique_ptr<FrontendAction> create() override {
+    return std::make_unique<Action>(Finder, Dependencies);
+  }
 
-bool applySourceChanges(const AtomicChanges &Changes) {
-  std::set<std::string> Files;
-  for (const auto &Change : Changes)
-    Files.insert(Change.getFilePath());
-  tooling::ApplyChangesSpec Spec;
-  Spec.Cleanup = false;
-  for (const auto &File : Files) {
-    llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> BufferErr =
-        llvm::MemoryBuffer::getFile(File);
-    if (!BufferErr) {
-      llvm::errs() << "error: failed to open " << File << " for rewriting\n";
-      return true;
+private:
+  class Action : public ASTFrontendAction {
+  public:
+    Action(MatchFinder &Finder, std::vector<std::string> &Dependencies)
+        : Finder(Finder), Dependencies(Dependencies) {}
+
+    std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &CI,
+                                                   StringRef) override {
+      // The main file is entered once parsing starts, so attaching here
+      // still sees every file. The files of a PCH are reported by its reader,
+      // which is only created afterwards.
+      Collector->attachToPreprocessor(CI.getPreprocessor());
+      CI.addDependencyCollector(Collector);
+      return Finder.newASTConsumer();
     }
-    auto Result = tooling::applyAtomicChanges(File, (*BufferErr)->getBuffer(),
-                                              Changes, Spec);
-    if (!Result) {
-      llvm::errs() << toString(Result.takeError());
-      return true;
+
+    void EndSourceFileAction() override {
+      auto &FS = getCompilerInstance().getVirtualFileSystem();
+      for (const auto &File : Collector->getDependencies()) {
+        SmallString<256> Path(File);
+        FS.makeAbsolute(Path);
+        sys::path::remove_dots(Path, /*remove_dot_dot=*/true);
+        Dependencies.push_back(std::string(Path));
+      }
     }
-    llvm::outs() << *Result;
-  }
-  return false;
+
+  private:
+    MatchFinder &Finder;
+    std::vector<std::string> &Dependencies;
+    std::shared_ptr<AllDependencyCollector> Collector =
+        std::make_shared<AllDependencyCollector>();
+  };
+
+  MatchFinder &Finder;
+  std::vector<std::string> &Dependencies;
+};
+} // namespace
+
+// Options of the tool that change the rewritten code, so that the cache does
+// not replay changes made with other ones.
+static std::string getOptionsKey() {
+  return formatv(
+      "backend={0};min-parallel-work={1};instrument={2};fuse={3}",
+      static_cast<int>(TargetBackend.getValue()), MinParallelWork.getValue(),
+      Instrument.getValue(), Fuse.getValue());
 }
 
-int main(int argc, const char **argv) {
-  auto ExpectedParser =
-      CommonOptionsParser::create(argc, argv, ParallelTransformCategory);
-  if (!ExpectedParser) {
-    llvm::errs() << ExpectedParser.takeError();
-    return 1;
+static parallel::LoweringOptions getLoweringOptions() {
+  parallel::LoweringOptions Options;
+  Options.Target = TargetBackend;
+  Options.MinParallelWork = MinParallelWork;
+  Options.Instrument = Instrument;
+  Options.Fuse = Fuse;
+  return Options;
+}
+
+// Runs the rewrite rule over File alone, with its own Transformer, so that
+// several translation units can be transformed at the same time.
+static TUResult transformTU(const CompilationDatabase &Compilations,
+                            StringRef File,
+                            const parallel::TransformCache *Cache,
+                            parallel::SharedPreambles *Preambles) {
+  TUResult Result;
+  auto Start = std::chrono::steady_clock::now();
+  auto Finish = [&] {
+    Result.Seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - Start)
+                         .count();
+    return std::move(Result);
+  };
+
+  // Let Clang report unreadable files.
+  auto Code = MemoryBuffer::getFile(File);
+  if (Code && PreScan && !(*Code)->getBuffer().contains("parallel")) {
+    Result.Skipped = true;
+    return Finish();
+  }
+  std::string Key;
+  if (Code && Cache) {
+    Key = parallel::TransformCache::getKey(
+        File, (*Code)->getBuffer(), Compilations.getCompileCommands(File),
+        getOptionsKey());
+    if (auto Changes = Cache->lookup(Key)) {
+      Result.Changes = std::move(*Changes);
+      Result.Skipped = Result.Cached = true;
+      return Finish();
+    }
   }
-  CommonOptionsParser &OptionsParser = ExpectedParser.get();
-  ClangTool Tool(OptionsParser.getCompilations(),
-                 OptionsParser.getSourcePathList());
 
-  AtomicChanges Changes;
+  // The real file system changes the working directory of the process for
+  // every compile command, which the other workers would observe. A physical
+  // file system keeps its own working directory.
+  ClangTool Tool(Compilations, {std::string(File)},
+                 Preambles ? Preambles->getPCHContainerOperations()
+                           : std::make_shared<PCHContainerOperations>(),
+                 IntrusiveRefCntPtr<vfs::FileSystem>(
+                     vfs::createPhysicalFileSystem().release()));
+  if (Code && Preambles)
+    if (auto PCH = Preambles->getPCH(File, (*Code)->getBuffer(),
+                                     Compilations.getCompileCommands(File)))
+      Tool.appendArgumentsAdjuster(getInsertArgumentAdjuster(
+          {"-include-pch", *PCH}, ArgumentInsertPosition::BEGIN));
   auto Consumer = [&](Expected<MutableArrayRef<AtomicChange>> C) {
     if (C) {
-      Changes.insert(Changes.end(), std::make_move_iterator(C->begin()),
-                     std::make_move_iterator(C->end()));
+      Result.Changes.insert(Result.Changes.end(),
+                            std::make_move_iterator(C->begin()),
+                            std::make_move_iterator(C->end()));
     } else {
       llvm::errs() << "Error generating changes: "
                    << llvm::toString(C.takeError()) << "\n";
+      Result.Failed = true;
     }
   };
-
-  auto varWithoutColon =
-      [](const ast_matchers::MatchFinder::MatchResult &result)
-      -> Expected<CharSourceRange> {
-    auto range = node("var")(result);
-    if (!range)
-      return range.takeError();
-    range->setEnd(range->getEnd().getLocWithOffset(-1));
-    return range;
-  };
-
-  auto Rule = makeRule(
-      buildMatcher(),
-      {addInclude("algorithm", IncludeFormat::Angled),
-       addInclude("execution", IncludeFormat::Angled),
-       changeTo(cat("std::for_each(std::execution::par, ", "std::begin(",
-                    node("range"), "), ", "std::end(", node("range"), "), ",
-                    "[&](", varWithoutColon, ")", node("body"), ");"))});
-  Transformer Transformer(std::move(Rule), std::move(Consumer));
+  Transformer Transformer(parallel::buildParallelRule(getLoweringOptions()),
+                          std::move(Consumer));
   MatchFinder Finder;
   Transformer.registerMatchers(&Finder);
+  std::vector<std::string> Dependencies;
+  CollectingActionFactory Factory(Finder, Dependencies);
+  if (Tool.run(&Factory))
+    Result.Failed = true;
+  // A shared preamble is deleted at the end of the run, and the headers it
+  // was built from are recorded by its reader.
+  if (Preambles)
+    erase_if(Dependencies, [&](const std::string &Path) {
+      return sys::path::parent_path(Path) == Preambles->getDirectory();
+    });
+
+  if (!Key.empty() && !Result.Failed)
+    if (auto Err = Cache->store(Key, Dependencies, Result.Changes))
+      llvm::errs() << "warning: not cached: " << toString(std::move(Err))
+                   << "\n";
+  return Finish();
+}
+
+// Concatenates the changes of every translation unit in command line order.
+// A header included by several translation units is rewritten identically by
+// each of them, so a change already seen is dropped instead of conflicting.
+static AtomicChanges mergeChanges(MutableArrayRef<TUResult> Results) {
+  AtomicChanges Merged;
+  std::set<std::string> Seen;
+  for (auto &Result : Results)
+    for (auto &Change : Result.Changes)
+      if (Seen.insert(Change.toYAMLString()).second)
+        Merged.push_back(std::move(Change));
+  return Merged;
+}
 
-  Tool.run(newFrontendActionFactory(&Finder).get());
+// Returns where the rewritten File goes, or an empty path for stdout.
+static std::string getOutputPath(StringRef File) {
+  if (InPlace)
+    return std::string(File);
+  if (OutputDir.empty())
+    return "";
+  SmallString<256> Path(OutputDir);
+  sys::path::append(Path, sys::path::relative_path(File));
+  return std::string(Path);
+}
 
-  applySourceChanges(Changes);
-  return 0;
-}
\ No newline at end of file
+int main(int argc, const char **argv) {
+  auto ExpectedParser =
+      CommonOptionsParser::create(argc, argv, ParallelTransformCategory);
+  if (!ExpectedParser) {
+    llvm::errs() << ExpectedParser.takeError();
+    return 1;
+  }
+  CommonOptionsParser &OptionsParser = ExpectedParser.get();
+  if (InPlace && !OutputDir.empty()) {
+    llvm::errs() << "error: --in-place and --output-dir are exclusive\n";
+    return 1;
+  }
+  const auto &Files = OptionsParser.getSourcePathList();
+  const auto &Compilations = OptionsParser.getCompilations();
+  std::optional<parallel::TransformCache> Cache;
+  if (!CacheDir.empty())
+    Cache.emplace(CacheDir);
+  // The PCHs only stay valid while the headers they were built from are
+  // unchanged, so they are rebuilt by every run.
+  SmallString<128> PreambleDir;
+  std::optional<parallel::SharedPreambles> Preambles;
+  if (SharePreamble) {
+    if (auto EC = sys::fs::createUniqueDirectory("parallel-preamble",
+                                                 PreambleDir)) {
+      llvm::errs() << "error: " << EC.message() << "\n";
+      return 1;
+    }
+    Preambles.emplace(PreambleDir);
+  }
+
+  // Every translation unit writes its own slot, so the merge below does not
+  // depend on the order in which the workers finish.
+  std::vector<TUResult> Results(Files.size());
+  std::mutex ProgressMutex;
+  unsigned Done = 0;
+  {
+    DefaultThreadPool Pool(hardware_concurrency(Jobs));
+    for (size_t I = 0; I != Files.size(); ++I)
+      Pool.async([&, I] {
+        const auto &R = Results[I] =
+            transformTU(Compilations, Files[I], Cache ? &*Cache : nullptr,
+                        Preambles ? &*Preambles : nullptr);
+        StringRef Status = R.Failed   ? " (failed)"
+                           : R.Cached ? " (cached)"
+                           : R.Skipped ? " (skipped)"
+                                       : "";
+        std::lock_guard<std::mutex> Lock(ProgressMutex);
+        llvm::errs() << formatv("[{0}/{1}] {2:f2}s {3}{4}\n", ++Done,
+                                Files.size(), R.Seconds, Files[I], Status);
+      });
+    Pool.wait();
+  }
+  if (Preambles)
+    sys::fs::remove_directories(PreambleDir);
+
+  bool Failed =
+      llvm::any_of(Results, [](const TUResult &R) { return R.Failed; });
+  if (auto Err = parallel::applySourceChanges(mergeChanges(Results),
+                                              getOutputPath, llvm::outs())) {
+    llvm::errs() << "error: " << toString(std::move(Err)) << "\n";
+    Failed = true;
+  }
+  return Failed ? 1 : 0;
+}
@@ -0,0 +1,190 @@
+#include "SharedPreambles.h"
+
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/FrontendActions.h"
+#include "clang/Tooling/ArgumentsAdjusters.h"
+#include "clang/Tooling/Tooling.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/BLAKE3.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/VirtualFileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+namespace clang::parallel {
+
+// Returns the header name of a `#include <...>` line, with its brackets, or
+// an empty string for any other line.
+static StringRef getSystemInclude(StringRef Line) {
+  if (!Line.consume_front("#"))
+    return "";
+  Line = Line.ltrim();
+  if (!Line.consume_front("include"))
+    return "";
+  Line = Line.ltrim();
+  size_t End = Line.find('>');
+  if (!Line.starts_with("<") || End == StringRef::npos)
+    return "";
+  StringRef Rest = Line.drop_front(End + 1).trim();
+  if (!Rest.empty() && !Rest.starts_with("//"))
+    return "";
+  return Line.take_front(End + 1);
+}
+
+std::string SharedPreambles::getPreamble(StringRef Code) {
+  std::string Preamble;
+  bool InComment = false;
+  while (!Code.empty()) {
+    StringRef Line;
+    std::tie(Line, Code) = Code.split('\n');
+    Line = Line.trim();
+    // A line continued, or code following a block comment on its line, ends
+    // the preamble.
+    if (Line.ends_with("\\"))
+      break;
+    if (InComment || Line.starts_with("/*")) {
+      size_t End = Line.find("*/");
+      InComment = End == StringRef::npos;
+      if (!InComment && !Line.drop_front(End + 2).trim().empty())
+        break;
+      continue;
+    }
+    if (Line.empty() || Line.starts_with("//"))
+      continue;
+    StringRef Header = getSystemInclude(Line);
+    if (Header.empty())
+      break;
+    Preamble += ("#include " + Header + "\n").str();
+  }
+  return Preamble;
+}
+
+namespace {
+// The compile command of the header spelling a preamble.
+class HeaderDatabase : public tooling::CompilationDatabase {
+public:
+  explicit HeaderDatabase(tooling::CompileCommand Command)
+      : Command(std::move(Command)) {}
+
+  std::vector<tooling::CompileCommand>
+  getCompileCommands(StringRef) const override {
+    return {Command};
+  }
+
+private:
+  tooling::CompileCommand Command;
+};
+
+// Writes the PCH to Path. GeneratePCHAction writes it wherever -o points,
+// which the tool strips from the command line.
+class WritePCHAction : public GeneratePCHAction {
+public:
+  explicit WritePCHAction(StringRef Path) : Path(Path) {}
+
+protected:
+  bool BeginInvocation(CompilerInstance &CI) override {
+    CI.getFrontendOpts().OutputFile = Path;
+    return GeneratePCHAction::BeginInvocation(CI);
+  }
+
+private:
+  std::string Path;
+};
+
+class WritePCHActionFactory : public tooling::FrontendActionFactory {
+public:
+  explicit WritePCHActionFactory(StringRef Path) : Path(Path) {}
+
+  std::unique_ptr<FrontendAction> create() override {
+    return std::make_unique<WritePCHAction>(Path);
+  }
+
+private:
+  std::string Path;
+};
+} // namespace
+
+std::optional<std::string>
+SharedPreambles::getPCH(StringRef File, StringRef Code,
+                        ArrayRef<tooling::CompileCommand> Commands) {
+  if (Commands.size() != 1)
+    return std::nullopt;
+  std::string Preamble = getPreamble(Code);
+  if (Preamble.empty())
+    return std::nullopt;
+
+  // The flags shared by the units, which are those of File without its name
+  // and the files it writes.
+  const tooling::CompileCommand &Command = Commands.front();
+  tooling::CommandLineArguments CommandLine = tooling::combineAdjusters(
+      tooling::getClangStripOutputAdjuster(),
+      tooling::getClangStripDependencyFileAdjuster())(Command.CommandLine,
+                                                      Command.Filename);
+  erase_if(CommandLine, [&](const std::string &Arg) {
+    return Arg == Command.Filename || Arg == File;
+  });
+  BLAKE3 Hasher;
+  auto Add = [&](StringRef Field) {
+    Hasher.update(Field);
+    Hasher.update(StringRef("\0", 1));
+  };
+  Add(Preamble);
+  Add(Command.Directory);
+  for (const auto &Arg : CommandLine)
+    Add(Arg);
+  std::string Key = toHex(Hasher.final<16>(), /*LowerCase=*/true);
+
+  std::promise<std::optional<std::string>> Built;
+  std::shared_future<std::optional<std::string>> PCH;
+  bool Owner = false;
+  {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    auto &Entry = PCHs[Key];
+    if (!Entry.valid()) {
+      Entry = Built.get_future().share();
+      Owner = true;
+    }
+    PCH = Entry;
+  }
+  if (Owner)
+    Built.set_value(build(Key, Preamble, Command, std::move(CommandLine)));
+  return PCH.get();
+}
+
+std::optional<std::string>
+SharedPreambles::build(StringRef Key, StringRef Preamble,
+                       const tooling::CompileCommand &Command,
+                       std::vector<std::string> CommandLine) {
+  SmallString<256> Header(Dir), PCH(Dir);
+  sys::path::append(Header, Key + ".h");
+  sys::path::append(PCH, Key + ".pch");
+  if (auto Err = writeToOutput(Header, [&](raw_ostream &OS) {
+        OS << Preamble;
+        return Error::success();
+      })) {
+    errs() << "warning: no shared preamble: " << toString(std::move(Err))
+           << "\n";
+    return std::nullopt;
+  }
+
+  // The compiler stays the first argument, since its name may select the
+  // target and the driver mode.
+  CommandLine.push_back("-xc++-header");
+  CommandLine.push_back(std::string(Header));
+  HeaderDatabase Compilations(tooling::CompileCommand(
+      Command.Directory, Header, std::move(CommandLine), /*Output=*/""));
+  tooling::ClangTool Tool(Compilations, {std::string(Header)}, PCHOperations,
+                          IntrusiveRefCntPtr<vfs::FileSystem>(
+                              vfs::createPhysicalFileSystem().release()));
+  WritePCHActionFactory Factory(PCH);
+  if (Tool.run(&Factory)) {
+    errs() << "warning: no shared preamble for " << Header << "\n";
+    return std::nullopt;
+  }
+  return std::string(PCH);
+}
+
+} // namespace clang::parallel
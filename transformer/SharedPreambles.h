@@ -0,0 +1,67 @@
+#ifndef PARALLEL_SHARED_PREAMBLES_H
+#define PARALLEL_SHARED_PREAMBLES_H
+#include "clang/Serialization/PCHContainerOperations.h"
+#include "clang/Tooling/CompilationDatabase.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+
+namespace clang::parallel {
+
+// Precompiled headers shared by the translation units of a run, so that the
+// standard headers a unit starts with are parsed once per set of compile
+// flags instead of once per unit.
+//
+// The preamble of a main file is the run of `#include <...>` directives it
+// starts with, after blank lines and comments. Units with the same preamble,
+// working directory and flags, up to the name of the main file and of its
+// outputs, share one PCH built from a header spelling the preamble. They load
+// it with -include-pch, after which their own includes of the preamble find
+// the include guards defined and are skipped.
+class SharedPreambles {
+public:
+  // Headers and PCHs are written to Dir, which must exist.
+  explicit SharedPreambles(llvm::StringRef Dir) : Dir(Dir) {}
+
+  // Returns the preamble of Code, one directive per line, or an empty string
+  // if Code does not start with one.
+  static std::string getPreamble(llvm::StringRef Code);
+
+  // Returns the PCH for File, whose contents are Code, compiled with
+  // Commands. The first unit asking for a PCH builds it, while the others
+  // wait for it. Returns nullopt if File has no preamble, has several compile
+  // commands, or its PCH failed to build.
+  std::optional<std::string>
+  getPCH(llvm::StringRef File, llvm::StringRef Code,
+         llvm::ArrayRef<tooling::CompileCommand> Commands);
+
+  // The directory holding the headers and PCHs, which only lives as long as
+  // the run.
+  llvm::StringRef getDirectory() const { return Dir; }
+
+  // Writes and reads every PCH, and is shared by the units loading them.
+  std::shared_ptr<PCHContainerOperations> getPCHContainerOperations() const {
+    return PCHOperations;
+  }
+
+private:
+  std::string Dir;
+  std::shared_ptr<PCHContainerOperations> PCHOperations =
+      std::make_shared<PCHContainerOperations>();
+  std::mutex Mutex;
+  llvm::StringMap<std::shared_future<std::optional<std::string>>> PCHs;
+
+  std::optional<std::string> build(llvm::StringRef Key,
+                                   llvm::StringRef Preamble,
+                                   const tooling::CompileCommand &Command,
+                                   std::vector<std::string> CommandLine);
+};
+
+} // namespace clang::parallel
+
+#endif
@@ -0,0 +1,56 @@
+#include "SourceChanges.h"
+
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include <map>
+
+using namespace llvm;
+
+namespace clang::parallel {
+
+// Writes Code through a temporary file renamed over Path, so that a build
+// reading Path never sees a partially written file.
+static Error writeOutput(StringRef Path, StringRef Code) {
+  if (auto EC = sys::fs::create_directories(sys::path::parent_path(Path)))
+    return createFileError(Path, EC);
+  return writeToOutput(Path, [&](raw_ostream &OS) {
+    OS << Code;
+    return Error::success();
+  });
+}
+
+Error applySourceChanges(const tooling::AtomicChanges &Changes,
+                         function_ref<std::string(StringRef)> GetOutputPath,
+                         raw_ostream &Out) {
+  // applyAtomicChanges applies every change it is given, whatever file it
+  // was made to.
+  std::map<std::string, tooling::AtomicChanges> Files;
+  for (const auto &Change : Changes)
+    Files[Change.getFilePath()].push_back(Change);
+  tooling::ApplyChangesSpec Spec;
+  Spec.Cleanup = false;
+  for (const auto &[File, FileChanges] : Files) {
+    auto Buffer = MemoryBuffer::getFile(File);
+    if (!Buffer)
+      return createStringError(Buffer.getError(),
+                               "failed to open " + File + " for rewriting");
+    auto Result = tooling::applyAtomicChanges(File, (*Buffer)->getBuffer(),
+                                              FileChanges, Spec);
+    if (!Result)
+      return Result.takeError();
+    std::string Path = GetOutputPath(File);
+    if (Path.empty()) {
+      Out << *Result;
+      continue;
+    }
+    // Keep the modification time of files the rule did not change.
+    if (*Result == (*Buffer)->getBuffer())
+      continue;
+    if (auto Err = writeOutput(Path, *Result))
+      return Err;
+  }
+  return Error::success();
+}
+
+} // namespace clang::parallel
@@ -0,0 +1,24 @@
+#ifndef PARALLEL_SOURCE_CHANGES_H
+#define PARALLEL_SOURCE_CHANGES_H
+#include "clang/Tooling/Refactoring/AtomicChange.h"
+#include "llvm/ADT/STLFunctionalExtras.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/raw_ostream.h"
+#include <string>
+
+namespace clang::parallel {
+
+// Applies Changes to the files they edit, each file receiving only the
+// changes made to it. The rewritten file goes to GetOutputPath(File), or to
+// Out when that is empty. A file whose text does not change is not written,
+// so that it keeps its modification time.
+llvm::Error
+applySourceChanges(const tooling::AtomicChanges &Changes,
+                   llvm::function_ref<std::string(llvm::StringRef)>
+                       GetOutputPath,
+                   llvm::raw_ostream &Out);
+
+} // namespace clang::parallel
+
+#endif
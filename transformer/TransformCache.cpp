@@ -0,0 +1,133 @@
+#include "TransformCache.h"
+
+#include "clang/Basic/Version.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/BLAKE3.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+namespace clang::parallel {
+
+// Bumped whenever the format of an entry changes.
+static constexpr StringLiteral CacheMagic = "parallel-transformer-cache 2";
+
+// Hash of the sources of the tool, set by the build, so that an entry stored
+// by another build of the tool, which may lower differently, is not found.
+#ifndef PARALLEL_TRANSFORMER_SOURCE_HASH
+#define PARALLEL_TRANSFORMER_SOURCE_HASH ""
+#endif
+
+static std::string hashContents(StringRef Contents) {
+  return toHex(BLAKE3::hash<16>(arrayRefFromStringRef(Contents)),
+               /*LowerCase=*/true);
+}
+
+static std::optional<std::string> hashFile(StringRef Path) {
+  auto Buffer = MemoryBuffer::getFile(Path);
+  if (!Buffer)
+    return std::nullopt;
+  return hashContents((*Buffer)->getBuffer());
+}
+
+std::string
+TransformCache::getKey(StringRef File, StringRef Code,
+                       ArrayRef<tooling::CompileCommand> Commands,
+                       StringRef Options) {
+  BLAKE3 Hasher;
+  // Separates the fields, so that moving a character from one to the next
+  // changes the key.
+  auto Add = [&](StringRef Field) {
+    Hasher.update(Field);
+    Hasher.update(StringRef("\0", 1));
+  };
+  Add(CacheMagic);
+  Add(getClangFullVersion());
+  Add(PARALLEL_TRANSFORMER_SOURCE_HASH);
+  Add(Options);
+  Add(File);
+  Add(Code);
+  for (const auto &Command : Commands) {
+    Add(Command.Directory);
+    for (const auto &Arg : Command.CommandLine)
+      Add(Arg);
+  }
+  return toHex(Hasher.final<16>(), /*LowerCase=*/true);
+}
+
+std::string TransformCache::getEntryPath(StringRef Key) const {
+  SmallString<256> Path(Dir);
+  sys::path::append(Path, Key.take_front(2), Key.drop_front(2));
+  return std::string(Path);
+}
+
+// An entry is a text file:
+//
+//   parallel-transformer-cache 2
+//   dep <hash> <path>          for every dependency
+//   change <size>              for every change, followed by <size> bytes of
+//   <AtomicChange YAML>        AtomicChange::toYAMLString()
+std::optional<tooling::AtomicChanges>
+TransformCache::lookup(StringRef Key) const {
+  auto Buffer = MemoryBuffer::getFile(getEntryPath(Key));
+  if (!Buffer)
+    return std::nullopt;
+  StringRef Rest = (*Buffer)->getBuffer();
+  StringRef Line;
+  std::tie(Line, Rest) = Rest.split('\n');
+  if (Line != CacheMagic)
+    return std::nullopt;
+
+  tooling::AtomicChanges Changes;
+  while (!Rest.empty()) {
+    std::tie(Line, Rest) = Rest.split('\n');
+    auto [Kind, Value] = Line.split(' ');
+    if (Kind == "dep") {
+      auto [Hash, Path] = Value.split(' ');
+      auto Current = hashFile(Path);
+      if (!Current || *Current != Hash)
+        return std::nullopt;
+      continue;
+    }
+    size_t Size;
+    if (Kind != "change" || Value.getAsInteger(10, Size) || Size > Rest.size())
+      return std::nullopt;
+    Changes.push_back(
+        tooling::AtomicChange::convertFromYAML(Rest.take_front(Size)));
+    Rest = Rest.drop_front(Size);
+  }
+  return Changes;
+}
+
+Error TransformCache::store(StringRef Key, ArrayRef<std::string> Dependencies,
+                            const tooling::AtomicChanges &Changes) const {
+  std::string Path = getEntryPath(Key);
+  if (auto EC = sys::fs::create_directories(sys::path::parent_path(Path)))
+    return createFileError(Path, EC);
+  std::string Entry;
+  raw_string_ostream OS(Entry);
+  OS << CacheMagic << '\n';
+  for (const auto &Dependency : Dependencies) {
+    auto Hash = hashFile(Dependency);
+    if (!Hash)
+      return createStringError(inconvertibleErrorCode(),
+                               "cannot read dependency " + Dependency);
+    OS << "dep " << *Hash << ' ' << Dependency << '\n';
+  }
+  for (const auto &Change : Changes) {
+    std::string YAML = Change.toYAMLString();
+    OS << "change " << YAML.size() << '\n' << YAML;
+  }
+  // Written through a temporary file, so that a concurrent run never reads
+  // half an entry.
+  return writeToOutput(Path, [&](raw_ostream &Out) {
+    Out << Entry;
+    return Error::success();
+  });
+}
+
+} // namespace clang::parallel
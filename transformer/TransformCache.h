@@ -0,0 +1,47 @@
+#ifndef PARALLEL_TRANSFORM_CACHE_H
+#define PARALLEL_TRANSFORM_CACHE_H
+#include "clang/Tooling/CompilationDatabase.h"
+#include "clang/Tooling/Refactoring/AtomicChange.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+#include <optional>
+#include <string>
+
+namespace clang::parallel {
+
+// On-disk cache of the changes produced for a translation unit, so that a
+// unit whose sources and flags did not change is replayed without parsing.
+//
+// An entry is found by a key hashing the main file, its compile commands and
+// the build of the tool, and records every file the unit read along with the
+// hash of its contents. It is only replayed while all of them are unchanged.
+class TransformCache {
+public:
+  explicit TransformCache(llvm::StringRef Dir) : Dir(Dir) {}
+
+  // Returns the key of File with contents Code, compiled with Commands and
+  // rewritten with the tool options spelled by Options.
+  static std::string getKey(llvm::StringRef File, llvm::StringRef Code,
+                            llvm::ArrayRef<tooling::CompileCommand> Commands,
+                            llvm::StringRef Options);
+
+  // Returns the changes stored under Key, if the entry exists and none of
+  // its dependencies changed since it was stored.
+  std::optional<tooling::AtomicChanges> lookup(llvm::StringRef Key) const;
+
+  // Stores Changes under Key. Dependencies are absolute paths of every file
+  // read by the translation unit.
+  llvm::Error store(llvm::StringRef Key,
+                    llvm::ArrayRef<std::string> Dependencies,
+                    const tooling::AtomicChanges &Changes) const;
+
+private:
+  std::string Dir;
+
+  std::string getEntryPath(llvm::StringRef Key) const;
+};
+
+} // namespace clang::parallel
+
+#endif
@@ -0,0 +1,38 @@
+# Runs parallel-transformer twice over the same file with --cache-dir and
+# --share-preamble, and expects the second run to replay the changes of the
+# first one from the cache.
+#
+#   cmake -DTRANSFORMER=<parallel-transformer> -DWORK_DIR=<dir> -P <this>
+file(REMOVE_RECURSE ${WORK_DIR})
+file(MAKE_DIRECTORY ${WORK_DIR}/include)
+file(WRITE ${WORK_DIR}/include/work.h [=[
+#ifndef WORK_H
+#define WORK_H
+inline int twice(int x) { return 2 * x; }
+#endif
+]=])
+file(WRITE ${WORK_DIR}/input.cpp [=[
+#include <work.h>
+
+void test(int (&arr)[65536]) {
+  [[parallel]]
+  for (auto &i : arr) {
+    i = twice(i);
+  }
+}
+]=])
+
+foreach(Run first second)
+  execute_process(
+    COMMAND ${TRANSFORMER} --cache-dir=${WORK_DIR}/cache --share-preamble
+            ${WORK_DIR}/input.cpp -- -I${WORK_DIR}/include
+    RESULT_VARIABLE Result
+    OUTPUT_QUIET
+    ERROR_VARIABLE Progress)
+  if(NOT Result EQUAL 0)
+    message(FATAL_ERROR "${Run} run failed:\n${Progress}")
+  endif()
+endforeach()
+if(NOT Progress MATCHES "\\(cached\\)")
+  message(FATAL_ERROR "second run did not hit the cache:\n${Progress}")
+endif()
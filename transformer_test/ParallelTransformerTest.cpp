@@ -1,7 +1,11 @@
+#include "ParallelLowering.h"
+#include "ParallelOptions.h"
+#include "SourceChanges.h"
 #include "attributedStmtMatcher.h"
 
 #include "clang/ASTMatchers/ASTMatchFinder.h"
 #include "clang/ASTMatchers/ASTMatchers.h"
+#include "clang/Basic/SourceManager.h"
 #include "clang/Frontend/FrontendActions.h"
 #include "clang/Tooling/Refactoring/AtomicChange.h"
 #include "clang/Tooling/Tooling.h"
@@ -10,9 +14,16 @@
 #include "clang/Tooling/Transformer/Stencil.h"
 #include "clang/Tooling/Transformer/Transformer.h"
 #include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallString.h"
 #include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
 #include "llvm/Support/raw_ostream.h"
 #include "gtest/gtest.h"
+#include <chrono>
+#include <cstdint>
 #include <memory>
 
 using namespace clang;
@@ -126,4 +137,664 @@ TEST(Transformer, FunctionNameTransform) {
       applyAtomicChanges("input.cc", Input, Changes, ApplyChangesSpec());
   if (Result)
     llvm::errs() << *Result;
-}
\ No newline at end of file
+}
+// The tests of the shape of a lowering use small ranges, so they turn the
+// cost model off.
+static parallel::LoweringOptions
+loweringOptions(parallel::Backend Target = parallel::Backend::StdExecution,
+                std::uint64_t MinParallelWork = 0) {
+  parallel::LoweringOptions Options;
+  Options.Target = Target;
+  Options.MinParallelWork = MinParallelWork;
+  return Options;
+}
+
+// Runs the parallel rewrite rule over Input and returns the rewritten code.
+static std::string
+transformParallel(StringRef Input,
+                  parallel::LoweringOptions Options = loweringOptions()) {
+  AtomicChanges Changes;
+  Transformer Trans(parallel::buildParallelRule(Options),
+                    [&](llvm::Expected<llvm::MutableArrayRef<AtomicChange>> C) {
+                      if (C)
+                        Changes.insert(Changes.end(), C->begin(), C->end());
+                      else
+                        ADD_FAILURE() << llvm::toString(C.takeError());
+                    });
+  MatchFinder Finder;
+  Trans.registerMatchers(&Finder);
+  auto Factory = newFrontendActionFactory(&Finder);
+  EXPECT_TRUE(runToolOnCodeWithArgs(Factory->create(), Input,
+                                    std::vector<std::string>(), "input.cc"));
+  ApplyChangesSpec Spec;
+  Spec.Cleanup = false;
+  auto Result = applyAtomicChanges("input.cc", Input, Changes, Spec);
+  if (!Result) {
+    ADD_FAILURE() << llvm::toString(Result.takeError());
+    return "";
+  }
+  return *Result;
+}
+
+TEST(ParallelTransformer, SequentialRangeUsesForEach) {
+  std::string Output = transformParallel(R"cc(
+struct Iter {
+  int &operator*();
+  Iter &operator++();
+  bool operator!=(const Iter &) const;
+};
+struct List {
+  Iter begin();
+  Iter end();
+};
+void test(List &list) {
+  [[parallel]]
+  for (auto &i : list) {
+    i = i * 2;
+  }
+}
+  )cc");
+  EXPECT_TRUE(StringRef(Output).contains(
+      "std::for_each(std::execution::par_unseq, std::begin(list), "
+      "std::end(list)"));
+  EXPECT_TRUE(StringRef(Output).contains("#include <execution>"));
+}
+
+TEST(ParallelTransformer, NodeRangesAreSplitWithoutWalking) {
+  std::string Output = transformParallel(R"cc(
+namespace std {
+struct forward_iterator_tag {};
+struct bidirectional_iterator_tag : forward_iterator_tag {};
+template <class T> struct list {
+  struct iterator {
+    using iterator_category = bidirectional_iterator_tag;
+    T &operator*();
+    iterator &operator++();
+    bool operator!=(const iterator &) const;
+  };
+  iterator begin();
+  iterator end();
+};
+template <class T> struct unordered_set {
+  using iterator = typename list<T>::iterator;
+  iterator begin();
+  iterator end();
+};
+} // namespace std
+void test(std::list<int> &list, std::unordered_set<int> &set) {
+  [[parallel]]
+  for (auto &i : list) {
+    i = i * 2;
+  }
+  [[parallel]]
+  for (auto &i : set) {
+    i = i * 2;
+  }
+}
+  )cc");
+  EXPECT_TRUE(StringRef(Output).contains(
+      "_par_ptrs.push_back(std::addressof(_par_e));"));
+  EXPECT_TRUE(StringRef(Output).contains("= *_par_first[_par_k];"));
+  EXPECT_TRUE(
+      StringRef(Output).contains("_par_n = _par_range.bucket_count();"));
+  EXPECT_TRUE(StringRef(Output).contains(
+      "for (auto _par_it = _par_range.begin(_par_k); "));
+}
+
+TEST(ParallelTransformer, RandomAccessRangeIsBlocked) {
+  std::string Output = transformParallel(R"cc(
+void test() {
+  int arr[]{1, 2, 3, 4, 5};
+  [[parallel]]
+  for (auto &i : arr) {
+    i = i * 2;
+  }
+}
+  )cc");
+  EXPECT_TRUE(StringRef(Output).contains("auto &&_par_range = arr;"));
+  EXPECT_TRUE(StringRef(Output).contains("_par_skew"));
+  EXPECT_TRUE(StringRef(Output).contains("= _par_first[_par_k];"));
+}
+
+TEST(ParallelTransformer, AdjacentLoopsOverOneRangeAreFused) {
+  std::string Output = transformParallel(R"cc(
+void test(float k, float hi) {
+  float arr[]{1, 2, 3, 4, 5};
+  [[parallel]]
+  for (auto &x : arr) {
+    x = x * k;
+  }
+  [[parallel]]
+  for (float &y : arr) {
+    y = y < hi ? y : hi;
+  }
+  [[parallel]]
+  for (auto &x : arr) {
+    x = x + arr[0];
+  }
+}
+  )cc");
+  EXPECT_TRUE(
+      StringRef(Output).contains("auto &&_par_elem = _par_first[_par_k];"));
+  EXPECT_TRUE(StringRef(Output).contains("auto &x = _par_elem;"));
+  EXPECT_TRUE(StringRef(Output).contains("float &y = _par_elem;"));
+  EXPECT_EQ(StringRef(Output).count("_par_blocks("), 2u);
+}
+
+TEST(ParallelTransformer, HonorsPolicyAndGrain) {
+  std::string Output = transformParallel(R"cc(
+void test() {
+  int arr[8192];
+  [[parallel("policy=par_unseq", "grain=4096", "schedule=dynamic")]]
+  for (auto &i : arr) {
+    i = i * 2;
+  }
+}
+  )cc");
+  EXPECT_TRUE(StringRef(Output).contains("std::execution::par_unseq"));
+  EXPECT_TRUE(
+      StringRef(Output).contains("const std::size_t _par_want = 4096;"));
+  EXPECT_FALSE(StringRef(Output).contains("[[parallel"));
+}
+
+TEST(ParallelTransformer, ReductionUsesTransformReduce) {
+  std::string Output = transformParallel(R"cc(
+double test(double (&arr)[1024]) {
+  double sum = 0;
+  [[parallel("reduce(+: sum)")]]
+  for (double x : arr) {
+    sum += x;
+  }
+  return sum;
+}
+  )cc");
+  EXPECT_TRUE(StringRef(Output).contains(
+      "sum = std::transform_reduce(std::execution::par"));
+  EXPECT_TRUE(StringRef(Output).contains("_par_sum_t sum = _par_sum_t{};"));
+  EXPECT_TRUE(StringRef(Output).contains("return sum;"));
+}
+
+TEST(ParallelTransformer, SeveralReductionsCombineInBlockOrder) {
+  std::string Output = transformParallel(R"cc(
+void test(int (&arr)[1024], int &lo, int &hi) {
+  [[parallel("reduce(min: lo)", "reduce(max: hi)")]]
+  for (int x : arr) {
+    lo = x < lo ? x : lo;
+    hi = x > hi ? x : hi;
+  }
+}
+  )cc");
+  EXPECT_TRUE(StringRef(Output).contains(
+      "_par_lo_t lo = std::numeric_limits<_par_lo_t>::max();"));
+  EXPECT_TRUE(StringRef(Output).contains("hi = std::max(hi, _par_hi_part);"));
+}
+
+TEST(ParallelTransformer, VectorizableBodyRunsUnsequenced) {
+  std::string Output = transformParallel(R"cc(
+double test(double (&arr)[1024]) {
+  double sum = 0;
+  [[parallel("reduce(+: sum)")]]
+  for (double x : arr) {
+    sum += x * x;
+  }
+  return sum;
+}
+  )cc");
+  EXPECT_TRUE(StringRef(Output).contains(
+      "sum = std::transform_reduce(std::execution::par_unseq"));
+  EXPECT_TRUE(
+      StringRef(Output).contains("#pragma omp simd reduction(+: sum)"));
+}
+
+TEST(ParallelTransformer, OpaqueCallKeepsPolicy) {
+  std::string Output = transformParallel(R"cc(
+void consume(double);
+void test(double (&arr)[1024]) {
+  [[parallel]]
+  for (double x : arr) {
+    consume(x);
+  }
+}
+  )cc");
+  EXPECT_TRUE(StringRef(Output).contains("std::execution::par,"));
+  EXPECT_FALSE(StringRef(Output).contains("par_unseq"));
+  EXPECT_FALSE(StringRef(Output).contains("#pragma omp simd"));
+}
+
+TEST(ParallelTransformer, LibraryCallKeepsPolicy) {
+  std::string Output = transformParallel(R"cc(
+extern "C" int printf(const char *, ...);
+extern "C" void *malloc(decltype(sizeof(0)));
+extern "C" void free(void *);
+void test(double (&arr)[1024], int (&sizes)[1024]) {
+  [[parallel]]
+  for (double x : arr) {
+    printf("%f\n", x);
+  }
+  [[parallel]]
+  for (int n : sizes) {
+    free(malloc(n));
+  }
+}
+  )cc");
+  EXPECT_EQ(StringRef(Output).count("std::execution::par,"), 2u);
+  EXPECT_FALSE(StringRef(Output).contains("par_unseq"));
+}
+
+TEST(ParallelTransformer, AllocatingMemberKeepsPolicy) {
+  std::string Output = transformParallel(R"cc(
+namespace std {
+template <class T> struct vector {
+  T *last = nullptr;
+  void push_back(const T &x) { last = new T(x); }
+};
+} // namespace std
+template <class T> inline T square(T x) { return x * x; }
+void test(std::vector<int> (&vecs)[1024], int (&arr)[1024]) {
+  [[parallel]]
+  for (auto &v : vecs) {
+    v.push_back(1);
+  }
+  [[parallel]]
+  for (auto &i : arr) {
+    i = square(i);
+  }
+}
+  )cc");
+  EXPECT_EQ(StringRef(Output).count("std::execution::par,"), 1u);
+  EXPECT_EQ(StringRef(Output).count("std::execution::par_unseq,"), 1u);
+  EXPECT_LT(StringRef(Output).find("std::execution::par,"),
+            StringRef(Output).find("std::execution::par_unseq,"));
+}
+
+TEST(ParallelTransformer, ElementIndexKeepsPolicy) {
+  std::string Output = transformParallel(R"cc(
+void test(int (&bins)[1024], int (&hist)[16]) {
+  [[parallel]]
+  for (int b : bins) {
+    hist[b]++;
+  }
+}
+  )cc");
+  EXPECT_TRUE(StringRef(Output).contains("std::execution::par,"));
+  EXPECT_FALSE(StringRef(Output).contains("par_unseq"));
+}
+
+TEST(ParallelTransformer, OpenMPBackendUsesPragma) {
+  std::string Output = transformParallel(R"cc(
+double test(double (&arr)[1024]) {
+  double sum = 0;
+  [[parallel("grain=256", "reduce(+: sum)")]]
+  for (double x : arr) {
+    sum += x;
+  }
+  return sum;
+}
+  )cc",
+      loweringOptions(parallel::Backend::OpenMP));
+  EXPECT_TRUE(StringRef(Output).contains(
+      "#pragma omp parallel for simd schedule(dynamic, 256) "
+      "reduction(+: sum)"));
+  EXPECT_TRUE(StringRef(Output).contains(
+      "for (std::ptrdiff_t _par_k = 0; _par_k < _par_n; ++_par_k) {"));
+  EXPECT_FALSE(StringRef(Output).contains("#include <execution>"));
+}
+
+TEST(ParallelTransformer, NativeBackendUsesRuntime) {
+  std::string Output = transformParallel(R"cc(
+double test(double (&arr)[1024]) {
+  double sum = 0;
+  [[parallel("reduce(+: sum)")]]
+  for (double x : arr) {
+    sum += x;
+  }
+  return sum;
+}
+  )cc",
+      loweringOptions(parallel::Backend::Native));
+  EXPECT_TRUE(StringRef(Output).contains("#include <parallel_rt.h>"));
+  EXPECT_TRUE(StringRef(Output).contains(
+      "parallel_rt::parallel_for(_par_nblocks, [&](std::size_t _par_b) {"));
+  EXPECT_TRUE(StringRef(Output).contains("sum = sum + _par_sum_part;"));
+  EXPECT_FALSE(StringRef(Output).contains("std::execution"));
+}
+
+TEST(ParallelTransformer, AffinityPinsStaticBlocks) {
+  std::string Output = transformParallel(R"cc(
+void test(double *a, int n) {
+  [[parallel("affinity=spread", "first_touch")]]
+  for (int i = 0; i < n; ++i) {
+    a[i] = 0;
+  }
+}
+  )cc");
+  EXPECT_TRUE(StringRef(Output).contains(
+      "parallel_rt::pinned_for(parallel_rt::affinity::spread, _par_nblocks, "
+      "[&](std::size_t _par_b) {"));
+  EXPECT_TRUE(StringRef(Output).contains(
+      "const std::size_t _par_workers = parallel_rt::num_threads();"));
+  EXPECT_TRUE(StringRef(Output).contains(
+      "std::max<std::size_t>(1, 4096 / sizeof(_par_index_t));"));
+  EXPECT_FALSE(StringRef(Output).contains("std::execution"));
+}
+
+TEST(ParallelTransformer, AsyncLaunchesIntoHandle) {
+  std::string Output = transformParallel(R"cc(
+namespace std {
+template <class T> struct future {
+  void wait() const;
+};
+} // namespace std
+void test(float (&a)[4096]) {
+  std::future<void> done;
+  [[parallel("async(done)")]]
+  for (float &x : a) {
+    x = x * 2;
+  }
+  done.wait();
+}
+  )cc");
+  EXPECT_TRUE(StringRef(Output).contains(
+      "done = std::async(std::launch::async, [&] {"));
+  EXPECT_TRUE(StringRef(Output).contains("#include <future>"));
+  EXPECT_TRUE(StringRef(Output).contains("});\n  done.wait();"));
+}
+
+TEST(ParallelTransformer, CheapLoopStaysSerial) {
+  std::string Output = transformParallel(R"cc(
+void test() {
+  int arr[]{1, 2, 3, 4, 5};
+  [[parallel]]
+  for (auto &i : arr) {
+    i = i * 2;
+  }
+}
+  )cc",
+      loweringOptions(parallel::Backend::StdExecution,
+                      parallel::DefaultMinParallelWork));
+  EXPECT_TRUE(StringRef(Output).contains("  for (auto &i : arr) {"));
+  EXPECT_FALSE(StringRef(Output).contains("[[parallel"));
+  EXPECT_FALSE(StringRef(Output).contains("_par_"));
+}
+
+TEST(ParallelTransformer, UnknownTripCountIsGuarded) {
+  std::string Output = transformParallel(R"cc(
+struct Span {
+  int *First, *Last;
+  int *begin() { return First; }
+  int *end() { return Last; }
+};
+void test(Span &s) {
+  [[parallel]]
+  for (auto &i : s) {
+    i = i * 2;
+  }
+}
+  )cc",
+      loweringOptions(parallel::Backend::StdExecution,
+                      parallel::DefaultMinParallelWork));
+  // Two operations per iteration.
+  EXPECT_TRUE(StringRef(Output).contains(
+      "if (std::end(s) - std::begin(s) < 16384) {"));
+  EXPECT_TRUE(StringRef(Output).contains("} else {"));
+  EXPECT_TRUE(StringRef(Output).contains("auto &&_par_range = s;"));
+}
+
+TEST(ParallelTransformer, InstrumentAddsProbes) {
+  parallel::LoweringOptions Options = loweringOptions();
+  Options.Instrument = true;
+  std::string Output = transformParallel(R"cc(
+void test(int (&arr)[1024]) {
+  [[parallel]]
+  for (auto &i : arr) {
+    i = i * 2;
+  }
+}
+  )cc",
+      Options);
+  EXPECT_TRUE(StringRef(Output).contains("#include <parallel_probe.h>"));
+  EXPECT_TRUE(StringRef(Output).contains(
+      "static parallel_probe::Region _par_region(\"input.cc\", 4);"));
+  EXPECT_TRUE(StringRef(Output).contains(
+      "parallel_probe::Call _par_call(_par_region);"));
+  EXPECT_TRUE(StringRef(Output).contains(
+      "parallel_probe::Task _par_task(_par_region, _par_hi - _par_lo);"));
+  EXPECT_TRUE(StringRef(Output).contains("std::execution::par,"));
+  EXPECT_FALSE(StringRef(Output).contains("par_unseq"));
+}
+
+TEST(ParallelTransformer, InstrumentedSequentialRangeIsBlocked) {
+  parallel::LoweringOptions Options = loweringOptions();
+  Options.Instrument = true;
+  std::string Output = transformParallel(R"cc(
+struct Iter {
+  int &operator*();
+  Iter &operator++();
+  bool operator!=(const Iter &) const;
+};
+struct List {
+  Iter begin();
+  Iter end();
+};
+void test(List &list) {
+  [[parallel]]
+  for (auto &i : list) {
+    i = i * 2;
+  }
+}
+  )cc",
+      Options);
+  EXPECT_FALSE(StringRef(Output).contains("std::for_each"));
+  EXPECT_TRUE(StringRef(Output).contains("std::next(_par_first, _par_lo);"));
+  EXPECT_EQ(StringRef(Output).count("parallel_probe::Task"), 1u);
+}
+
+TEST(ParallelTransformer, CountedLoopSplitsIndexRange) {
+  std::string Output = transformParallel(R"cc(
+void test(double *a, const double *b, unsigned long n) {
+  [[parallel]]
+  for (unsigned long i = 0; i < n; i += 2) {
+    a[i] = b[i] * 2;
+  }
+}
+  )cc",
+      loweringOptions(parallel::Backend::StdExecution,
+                      parallel::DefaultMinParallelWork));
+  EXPECT_TRUE(StringRef(Output).contains("if (n < 16384) {"));
+  EXPECT_TRUE(
+      StringRef(Output).contains("using _par_index_t = unsigned long;"));
+  EXPECT_TRUE(StringRef(Output).contains("const _par_index_t _par_end = n;"));
+  EXPECT_TRUE(StringRef(Output).contains(
+      "_par_index_t i = static_cast<_par_index_t>(_par_begin + _par_k * 2);"));
+  EXPECT_FALSE(StringRef(Output).contains("_par_range"));
+}
+
+TEST(ParallelTransformer, CollapseFlattensNest) {
+  std::string Output = transformParallel(R"cc(
+void test(float *img, int h, int w) {
+  [[parallel("collapse=2")]]
+  for (int y = 0; y < h; ++y) {
+    for (int x = 0; x < w; ++x) {
+      img[y * w + x] = 0;
+    }
+  }
+}
+  )cc");
+  EXPECT_TRUE(StringRef(Output).contains(
+      "const std::size_t _par_n = _par_n0 * _par_n1;"));
+  EXPECT_TRUE(StringRef(Output).contains(
+      "_par_index_t0 y = static_cast<_par_index_t0>(_par_begin0 + _par_i);"));
+  EXPECT_TRUE(StringRef(Output).contains(
+      "for (std::size_t _par_j = _par_j0; _par_j < _par_j1; ++_par_j) {"));
+  EXPECT_EQ(StringRef(Output).count("std::for_each"), 1u);
+}
+
+TEST(ParallelTransformer, NestedParallelLoopsAreCollapsed) {
+  std::string Output = transformParallel(R"cc(
+void test(float (&img)[64][64]) {
+  [[parallel]]
+  for (auto &row : img) {
+    [[parallel]]
+    for (int x = 0; x < 64; ++x) {
+      row[x] *= 2;
+    }
+  }
+}
+  )cc",
+      loweringOptions(parallel::Backend::OpenMP));
+  EXPECT_TRUE(StringRef(Output).contains(" collapse(2)"));
+  EXPECT_EQ(StringRef(Output).count("#pragma omp"), 1u);
+  EXPECT_FALSE(StringRef(Output).contains("[[parallel"));
+}
+
+TEST(ParallelTransformer, OrderedAppendUsesBlockParts) {
+  std::string Output = transformParallel(R"cc(
+namespace std {
+template <class T> struct vector {
+  T *begin() const;
+  T *end() const;
+  void push_back(const T &);
+};
+} // namespace std
+void test(const std::vector<int> &in, std::vector<float> &out) {
+  [[parallel]]
+  for (const int &x : in) {
+    if (x > 0)
+      out.push_back(x * 0.5f);
+  }
+}
+  )cc",
+      loweringOptions(parallel::Backend::OpenMP));
+  EXPECT_TRUE(StringRef(Output).contains("_par_out_t out;"));
+  EXPECT_TRUE(StringRef(Output).contains(
+      "_par_out_parts[_par_b] = std::move(out);"));
+  EXPECT_TRUE(StringRef(Output).contains("out.reserve(_par_out_size);"));
+  EXPECT_TRUE(StringRef(Output).contains("std::execution::par,"));
+  EXPECT_FALSE(StringRef(Output).contains("#pragma omp"));
+}
+
+TEST(ParallelTransformer, PrivateLocalIsHoistedPerBlock) {
+  std::string Output = transformParallel(R"cc(
+namespace std {
+template <class T> struct vector {
+  T *begin();
+  T *end();
+  void push_back(const T &);
+  void clear();
+};
+} // namespace std
+int use(std::vector<int> &);
+void test(std::vector<int> &v) {
+  [[parallel("private(buf)")]]
+  for (auto &i : v) {
+    std::vector<int> buf;
+    buf.push_back(i);
+    i = use(buf);
+  }
+}
+  )cc");
+  StringRef Text(Output);
+  size_t Decl = Text.find("    std::vector<int> buf;\n");
+  size_t Loop = Text.find("for (std::size_t _par_k = _par_lo;");
+  ASSERT_NE(Decl, StringRef::npos);
+  EXPECT_LT(Decl, Loop);
+  EXPECT_EQ(Text.count("std::vector<int> buf;"), 1u);
+  EXPECT_TRUE(Text.drop_front(Loop).contains("buf.clear();"));
+}
+
+// A change of Contents, the text of File, replacing Length characters from
+// Offset with Text.
+static AtomicChange makeChange(StringRef File, StringRef Contents,
+                               unsigned Offset, unsigned Length,
+                               StringRef Text) {
+  SourceManagerForFile Sources(File, Contents);
+  const SourceManager &SM = Sources.get();
+  SourceLocation Loc =
+      SM.getLocForStartOfFile(SM.getMainFileID()).getLocWithOffset(Offset);
+  AtomicChange Change(SM, Loc);
+  EXPECT_FALSE(llvm::errorToBool(Change.replace(SM, Loc, Length, Text)));
+  return Change;
+}
+
+TEST(SourceChanges, EveryFileGetsItsOwnChanges) {
+  llvm::SmallString<128> Dir;
+  ASSERT_FALSE(llvm::sys::fs::createUniqueDirectory("source-changes", Dir));
+  llvm::SmallString<128> Edited(Dir), Untouched(Dir);
+  llvm::sys::path::append(Edited, "edited.cc");
+  llvm::sys::path::append(Untouched, "untouched.cc");
+  for (StringRef File : {Edited.str(), Untouched.str()}) {
+    std::error_code EC;
+    llvm::raw_fd_ostream(File, EC) << "int x = 1;\n";
+    ASSERT_FALSE(EC);
+  }
+  // An old modification time, which a rewrite would replace.
+  llvm::sys::TimePoint<> Old = std::chrono::system_clock::now() -
+                               std::chrono::hours(24);
+  {
+    int FD;
+    ASSERT_FALSE(llvm::sys::fs::openFileForWrite(
+        Untouched, FD, llvm::sys::fs::CD_OpenExisting));
+    ASSERT_FALSE(llvm::sys::fs::setLastAccessAndModificationTime(FD, Old));
+    llvm::sys::Process::SafelyCloseFileDescriptor(FD);
+  }
+
+  // Both changes replace the same offset of their own file, which conflicts
+  // when a file is given the changes of the other.
+  AtomicChanges Changes = {
+      makeChange(Edited, "int x = 1;\n", 8, 1, "2"),
+      makeChange(Untouched, "int x = 1;\n", 8, 1, "1")};
+  std::string Printed;
+  llvm::raw_string_ostream Out(Printed);
+  EXPECT_FALSE(llvm::errorToBool(parallel::applySourceChanges(
+      Changes, [](StringRef File) { return File.str(); }, Out)));
+  EXPECT_TRUE(Printed.empty());
+
+  auto Buffer = llvm::MemoryBuffer::getFile(Edited);
+  ASSERT_TRUE(Buffer);
+  EXPECT_EQ((*Buffer)->getBuffer(), "int x = 2;\n");
+  Buffer = llvm::MemoryBuffer::getFile(Untouched);
+  ASSERT_TRUE(Buffer);
+  EXPECT_EQ((*Buffer)->getBuffer(), "int x = 1;\n");
+  llvm::sys::fs::file_status Status;
+  ASSERT_FALSE(llvm::sys::fs::status(Untouched, Status));
+  EXPECT_EQ(std::chrono::time_point_cast<std::chrono::seconds>(
+                Status.getLastModificationTime()),
+            std::chrono::time_point_cast<std::chrono::seconds>(Old));
+  llvm::sys::fs::remove_directories(Dir);
+}
+
+TEST(ParallelOptions, RejectsMalformedClauses) {
+  parallel::ParallelOptions Opts;
+  EXPECT_FALSE(llvm::errorToBool(
+      parallel::parseParallelClause("policy=par_unseq", Opts)));
+  EXPECT_EQ(Opts.Policy, parallel::ExecutionPolicy::ParUnseq);
+  EXPECT_TRUE(llvm::errorToBool(parallel::parseParallelClause("grain=0", Opts)));
+  EXPECT_TRUE(llvm::errorToBool(parallel::parseParallelClause("chunk=4", Opts)));
+  EXPECT_TRUE(
+      llvm::errorToBool(parallel::parseParallelClause("collapse=3", Opts)));
+  EXPECT_TRUE(
+      llvm::errorToBool(parallel::parseParallelClause("policy=par", Opts)));
+  EXPECT_TRUE(
+      llvm::errorToBool(parallel::parseParallelClause("affinity=numa", Opts)));
+  EXPECT_FALSE(
+      llvm::errorToBool(parallel::parseParallelClause("first_touch", Opts)));
+  EXPECT_TRUE(llvm::errorToBool(parallel::checkParallelOptions(Opts)));
+  EXPECT_TRUE(
+      llvm::errorToBool(parallel::parseParallelClause("private(a, a)", Opts)));
+}
+
+TEST(ParallelOptions, ParsesReductions) {
+  parallel::ParallelOptions Opts;
+  EXPECT_FALSE(llvm::errorToBool(
+      parallel::parseParallelClause("reduce(+: sum, count)", Opts)));
+  EXPECT_FALSE(llvm::errorToBool(
+      parallel::parseParallelClause("reduce(stats::merge: hist)", Opts)));
+  ASSERT_EQ(Opts.Reductions.size(), 3u);
+  EXPECT_EQ(Opts.Reductions[1].Var, "count");
+  EXPECT_EQ(Opts.Reductions[2].Op, "stats::merge");
+  EXPECT_FALSE(Opts.Reductions[2].isBuiltinOp());
+  EXPECT_TRUE(llvm::errorToBool(
+      parallel::parseParallelClause("reduce(*: sum)", Opts)));
+  EXPECT_TRUE(
+      llvm::errorToBool(parallel::parseParallelClause("reduce(+ sum)", Opts)));
+}